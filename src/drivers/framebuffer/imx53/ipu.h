@@ -22,11 +22,17 @@ namespace Framebuffer { struct Ipu; }
 
 struct Framebuffer::Ipu : Platform::Device::Mmio
 {
-	struct Conf            : Register<0x0,   32> { };
+	struct Conf            : Register<0x0,   32>
+	{
+			struct Ic_en : Bitfield<1, 1> { };
+	};
 
 	template<unsigned NR>
 	struct Int_ctrl        : Register<0x3c+(NR*4), 32> { };
 
+	template<unsigned NR>
+	struct Int_stat        : Register<0x200+(NR*4), 32> { };
+
 	struct Srm_pri2 : Register<0xa4,  32>
 	{
 			struct Dp_m_srm : Bitfield<3,2> { enum { UPDATE_NOW = 1 }; };
@@ -48,6 +54,8 @@ struct Framebuffer::Ipu : Platform::Device::Mmio
 	 **************************************/
 
 	enum Idmac_channels {
+		CHAN_IC_PP_INPUT     = 11,
+		CHAN_IC_PP_OUTPUT    = 22,
 		CHAN_DP_PRIMARY_MAIN = 23,
 		CHAN_DP_PRIMARY_AUXI = 27,
 		CHAN_DC_SYNC_FLOW    = 28
@@ -138,6 +146,34 @@ struct Framebuffer::Ipu : Platform::Device::Mmio
 	struct Dmfc_ic_ctrl     : Register<0x6001c, 32> { };
 
 
+	/***************************************
+	 **  Image converter (IC) registers  **
+	 ***************************************/
+
+	struct Ic_conf : Register<0x20000, 32>
+	{
+			struct Pp_en   : Bitfield<16, 1> { };
+			struct Pp_csc1 : Bitfield<17, 1> { };
+	};
+
+	struct Ic_pp_rsc : Register<0x2000c, 32>
+	{
+			struct Hor_coeff    : Bitfield< 0, 14> { };
+			struct Hor_downsize : Bitfield<14,  2> { };
+			struct Ver_coeff    : Bitfield<16, 14> { };
+			struct Ver_downsize : Bitfield<30,  2> { };
+	};
+
+	struct Ic_idmac_1 : Register<0x20018, 32>
+	{
+			struct Cb2_burst_16 : Bitfield<2, 1> { }; /* CHAN_IC_PP_INPUT  */
+			struct Cb5_burst_16 : Bitfield<5, 1> { }; /* CHAN_IC_PP_OUTPUT */
+	};
+
+	/* colour-space-conversion matrix 1 of the post-processing task */
+	struct Tpm_pp_csc1 : Register_array<0x1066060, 32, 6, 32> { };
+
+
 	class Cp_mem
 	{
 		public:
@@ -244,6 +280,120 @@ struct Framebuffer::Ipu : Platform::Device::Mmio
 	}
 
 
+	/**
+	 * Hardware-accelerated scaling and colour-space conversion
+	 *
+	 * A task lets the post-processing section of the image converter read
+	 * a YUV420 (I420), NV12, or 32-bit RGB frame from memory, resize it and
+	 * write it as RGB888 to a destination buffer in the format of the
+	 * display planes. The destination may thereby be the main-plane buffer
+	 * or an overlay buffer as used with 'overlay()'.
+	 */
+	struct Ic_task
+	{
+		enum Format { YUV420, NV12, RGB32 };
+
+		Format           format;
+		Genode::addr_t   src_phys;
+		Genode::uint16_t src_width;
+		Genode::uint16_t src_height;
+		Genode::uint32_t src_stride;  /* bytes per (luma) line */
+		Genode::addr_t   dst_phys;
+		Genode::uint16_t dst_width;
+		Genode::uint16_t dst_height;
+		Genode::uint32_t dst_stride;  /* bytes per RGB line  */
+	};
+
+	/**
+	 * Write a single field of the channel parameter memory
+	 *
+	 * The planar YUV formats re-use bits of the interleaved layout
+	 * described by 'Cp_mem' for the chroma offsets and stride, therefore
+	 * the IC input channel gets programmed field by field.
+	 */
+	void _cpmem_field(unsigned channel, unsigned word, unsigned bit,
+	                  unsigned width, Genode::uint32_t value)
+	{
+		using namespace Genode;
+
+		volatile uint32_t *w = (volatile uint32_t*)
+			(base() + Cp_mem::OFFSET + channel*sizeof(Cp_mem)) + word*8;
+
+		unsigned const i     = bit / 32;
+		unsigned const shift = bit % 32;
+		uint64_t const mask  = ((1ULL << width) - 1) << shift;
+
+		uint64_t v = w[i] | ((uint64_t)w[i+1] << 32);
+		v = (v & ~mask) | (((uint64_t)value << shift) & mask);
+		w[i]   = (uint32_t)v;
+		w[i+1] = (uint32_t)(v >> 32);
+	}
+
+
+	void _init_ic_input_channel(Ic_task const &task, unsigned burst)
+	{
+		using namespace Genode;
+
+		enum { PFS_YUV420 = 2, PFS_NV12 = 4 };
+
+		if (task.format == Ic_task::RGB32) {
+			_init_dma_channel(CHAN_IC_PP_INPUT, task.src_width, task.src_height,
+			                  task.src_stride, task.src_phys);
+			_cpmem_field(CHAN_IC_PP_INPUT, 1, 78, 7, burst - 1); /* NPB */
+			return;
+		}
+
+		/* clear all parameters of the channel */
+		Cp_mem cpmem;
+		Genode::memcpy((void*)(base() + Cp_mem::OFFSET +
+		                       CHAN_IC_PP_INPUT*sizeof(Cp_mem)),
+		               (void*)&cpmem, sizeof(Cp_mem));
+
+		uint32_t const y_size = task.src_stride * task.src_height;
+		uint32_t const u_off  = y_size;
+		uint32_t const v_off  = (task.format == Ic_task::NV12)
+		                      ? u_off : u_off + y_size / 4;
+		uint32_t const uv_sl  = (task.format == Ic_task::NV12)
+		                      ? task.src_stride : task.src_stride / 2;
+
+		_cpmem_field(CHAN_IC_PP_INPUT, 0,  46, 22, u_off >> 3);       /* UBO  */
+		_cpmem_field(CHAN_IC_PP_INPUT, 0,  68, 22, v_off >> 3);       /* VBO  */
+		_cpmem_field(CHAN_IC_PP_INPUT, 0, 125, 13, task.src_width - 1);  /* FW */
+		_cpmem_field(CHAN_IC_PP_INPUT, 0, 138, 12, task.src_height - 1); /* FH */
+		_cpmem_field(CHAN_IC_PP_INPUT, 1,   0, 29, (uint32_t)(task.src_phys >> 3));
+		_cpmem_field(CHAN_IC_PP_INPUT, 1,  29, 29, (uint32_t)(task.src_phys >> 3));
+		_cpmem_field(CHAN_IC_PP_INPUT, 1,  78,  7, burst - 1);        /* NPB  */
+		_cpmem_field(CHAN_IC_PP_INPUT, 1,  85,  4, (task.format == Ic_task::NV12)
+		                                           ? PFS_NV12 : PFS_YUV420);
+		_cpmem_field(CHAN_IC_PP_INPUT, 1, 102, 14, task.src_stride - 1); /* SLY */
+		_cpmem_field(CHAN_IC_PP_INPUT, 1, 128, 14, uv_sl - 1);       /* SLUV */
+	}
+
+
+	/**
+	 * Calculate downsizing and resizing coefficient for one dimension
+	 *
+	 * The IC is able to downsize by 2 or 4 in a pre-filter step followed by
+	 * the bilinear resizing with a fixed-point coefficient of 13 fractional
+	 * bits. The resizing section is limited to 1024 output pixels.
+	 */
+	static bool _resize_coeffs(unsigned in, unsigned out,
+	                           unsigned &resize, unsigned &downsize)
+	{
+		if (out < 2 || out > 1024 || (in >> 2) >= out)
+			return false;
+
+		downsize = 0;
+		while ((in > 1024 || in >= out*2) && downsize < 2) {
+			in >>= 1;
+			downsize++;
+		}
+
+		resize = ((in - 1) * 8192) / (out - 1);
+		return resize < 16384;
+	}
+
+
 	void _init_di0(Genode::uint16_t width, Genode::uint16_t height,
 	               Genode::uint32_t stride, Genode::addr_t phys_base)
 	{
@@ -522,6 +672,111 @@ struct Framebuffer::Ipu : Platform::Device::Mmio
 	}
 
 
+	/**
+	 * Return true if the IC is able to perform the task
+	 *
+	 * Widths have to be multiples of 8 pixels, the scaling ratio is limited
+	 * to a downsizing of less than 4:1 per dimension.
+	 */
+	static bool ic_supported(Ic_task const &task)
+	{
+		unsigned resize, down;
+
+		return !(task.src_width % 8) && !(task.dst_width % 8) &&
+		       _resize_coeffs(task.src_width,  task.dst_width,  resize, down) &&
+		       _resize_coeffs(task.src_height, task.dst_height, resize, down);
+	}
+
+	/**
+	 * Start conversion task
+	 *
+	 * \return  false if the task exceeds the capabilities of the IC
+	 */
+	bool ic_start(Ic_task const &task)
+	{
+		unsigned h_resize, h_down, v_resize, v_down;
+
+		if (!ic_supported(task))
+			return false;
+
+		_resize_coeffs(task.src_width,  task.dst_width,  h_resize, h_down);
+		_resize_coeffs(task.src_height, task.dst_height, v_resize, v_down);
+
+		bool const csc = task.format != Ic_task::RGB32;
+
+		/* YCbCr (ITU-R BT.601, limited range) to RGB */
+		static Genode::int32_t const coeff[3][3] = { { 149,   0,  204 },
+		                                             { 149, -50, -104 },
+		                                             { 149, 258,    0 } };
+		static Genode::int32_t const offset[3]   = { -448, 266, -553 };
+		enum { SCALE = 2 };
+
+		auto bits = [] (Genode::int32_t v, Genode::uint32_t mask,
+		                unsigned shift) {
+			return ((Genode::uint32_t)v & mask) << shift; };
+
+		write<Tpm_pp_csc1>(bits(offset[0], 0x1f, 27) | bits(coeff[0][0], 0x1ff, 18) |
+		                   bits(coeff[1][1], 0x1ff, 9) | bits(coeff[2][2], 0x1ff, 0), 0);
+		write<Tpm_pp_csc1>((bits(offset[0], 0x1fe0, 0) >> 5) | (SCALE << 8), 1);
+		write<Tpm_pp_csc1>(bits(offset[1], 0x1f, 27) | bits(coeff[0][1], 0x1ff, 18) |
+		                   bits(coeff[1][0], 0x1ff, 9) | bits(coeff[2][0], 0x1ff, 0), 2);
+		write<Tpm_pp_csc1>(bits(offset[1], 0x1fe0, 0) >> 5, 3);
+		write<Tpm_pp_csc1>(bits(offset[2], 0x1f, 27) | bits(coeff[0][2], 0x1ff, 18) |
+		                   bits(coeff[1][2], 0x1ff, 9) | bits(coeff[2][1], 0x1ff, 0), 4);
+		write<Tpm_pp_csc1>(bits(offset[2], 0x1fe0, 0) >> 5, 5);
+
+		Ic_pp_rsc::access_t rsc = 0;
+		Ic_pp_rsc::Hor_coeff::set(rsc, h_resize);
+		Ic_pp_rsc::Hor_downsize::set(rsc, h_down);
+		Ic_pp_rsc::Ver_coeff::set(rsc, v_resize);
+		Ic_pp_rsc::Ver_downsize::set(rsc, v_down);
+		write<Ic_pp_rsc>(rsc);
+
+		unsigned const in_burst  = (task.src_width % 16) ? 8 : 16;
+		unsigned const out_burst = (task.dst_width % 16) ? 8 : 16;
+		write<Ic_idmac_1::Cb2_burst_16>(in_burst  == 16);
+		write<Ic_idmac_1::Cb5_burst_16>(out_burst == 16);
+
+		_init_ic_input_channel(task, in_burst);
+		_init_dma_channel(CHAN_IC_PP_OUTPUT, task.dst_width, task.dst_height,
+		                  task.dst_stride, task.dst_phys);
+		_cpmem_field(CHAN_IC_PP_OUTPUT, 1, 78, 7, out_burst - 1); /* NPB */
+
+		/* acknowledge stale end-of-frame interrupt of the output channel */
+		write<Int_stat<0> >(1 << CHAN_IC_PP_OUTPUT);
+
+		write<Ch_buf0_rdy0>(1 << CHAN_IC_PP_INPUT | 1 << CHAN_IC_PP_OUTPUT);
+		write<Idmac_ch_en::Ch>(1, CHAN_IC_PP_INPUT);
+		write<Idmac_ch_en::Ch>(1, CHAN_IC_PP_OUTPUT);
+
+		write<Conf::Ic_en>(1);
+
+		Ic_conf::access_t conf = read<Ic_conf>();
+		Ic_conf::Pp_csc1::set(conf, csc);
+		Ic_conf::Pp_en::set(conf, 1);
+		write<Ic_conf>(conf);
+		return true;
+	}
+
+	/**
+	 * Return true if the last started task is complete
+	 */
+	bool ic_done() {
+		return read<Int_stat<0> >() & (1 << CHAN_IC_PP_OUTPUT); }
+
+	/**
+	 * Disable the post-processing task after completion
+	 */
+	void ic_finish()
+	{
+		write<Ic_conf::Pp_en>(0);
+		write<Idmac_ch_en::Ch>(0, CHAN_IC_PP_INPUT);
+		write<Idmac_ch_en::Ch>(0, CHAN_IC_PP_OUTPUT);
+		write<Int_stat<0> >(1 << CHAN_IC_PP_OUTPUT);
+		write<Conf::Ic_en>(0);
+	}
+
+
 	void overlay(Genode::addr_t phys_base, int x, int y, int alpha)
 	{
 		volatile Genode::uint32_t *ptr = (volatile Genode::uint32_t*)
@@ -17,11 +17,13 @@
 #include <base/component.h>
 #include <base/log.h>
 #include <capture_session/connection.h>
+#include <cpu/cache.h>
 #include <dataspace/client.h>
 #include <platform_session/connection.h>
 #include <platform_session/dma_buffer.h>
 #include <platform_session/device.h>
 #include <timer_session/connection.h>
+#include <util/reconstructible.h>
 
 /* local includes */
 #include <ipu.h>
@@ -45,40 +47,243 @@ struct Framebuffer::Main
 	static size_t _height(Xml_node node) {
 		return node.attribute_value<size_t>("height", 480UL); }
 
+	enum Resolutions { BYTES_PER_PIXEL  = 4 };
+
+	/*
+	 * Hardware scaling
+	 *
+	 * With 'capture_width' and 'capture_height' configured, the capture
+	 * session has this size, and the image converter of the IPU scales
+	 * each captured frame to the display size.
+	 */
+	static Capture::Area _capture_area(Xml_node node, Capture::Area size)
+	{
+		Capture::Area const area {
+			node.attribute_value("capture_width",  size.w()),
+			node.attribute_value("capture_height", size.h()) };
+
+		if (area == size)
+			return size;
+
+		Ipu::Ic_task const task {
+			.format     = Ipu::Ic_task::RGB32,
+			.src_phys   = 0,
+			.src_width  = (uint16_t)area.w(),
+			.src_height = (uint16_t)area.h(),
+			.src_stride = (uint32_t)(area.w() * BYTES_PER_PIXEL),
+			.dst_phys   = 0,
+			.dst_width  = (uint16_t)size.w(),
+			.dst_height = (uint16_t)size.h(),
+			.dst_stride = (uint32_t)(size.w() * BYTES_PER_PIXEL) };
+
+		if (Ipu::ic_supported(task))
+			return area;
+
+		warning("scaling from ", area, " to ", size, " not supported");
+		return size;
+	}
+
 	Env &                       _env;
 	Attached_rom_dataspace      _config   { _env, "config" };
 	unsigned                    _disp     { _display(_config.xml()) };
 	Capture::Area const         _size     { _width(_config.xml()),
 	                                        _height(_config.xml()) };
 	Platform::Connection        _platform { _env      };
-	Platform::Device            _device   { _platform };
 	Platform::Dma_buffer        _fb_buf   { _platform,
 	                                        _size.count()*sizeof(Pixel),
 	                                        CACHED };
-	Ipu                         _ipu      { _device   };
+	Capture::Area const         _capture_size { _capture_area(_config.xml(), _size) };
+	bool const                  _scale        { _capture_size != _size };
+	Constructible<Platform::Dma_buffer> _capture_buf { };
 	Capture::Connection         _capture  { _env };
-	Capture::Connection::Screen _captured_screen { _capture, _env.rm(), _size };
+	Capture::Connection::Screen _captured_screen { _capture, _env.rm(),
+	                                               _capture_size };
 	Timer::Connection           _timer { _env };
 	Signal_handler<Main>        _timer_handler { _env.ep(), *this,
 	                                             &Main::_handle_timer };
+	Signal_handler<Main>        _config_handler { _env.ep(), *this,
+	                                              &Main::_handle_config };
+
+	/*
+	 * The platform device is released while the display is blanked,
+	 * which lets the platform driver gate the IPU clock.
+	 */
+	struct Display
+	{
+		Platform::Device device;
+		Ipu              ipu { device };
+
+		Display(Platform::Connection &platform) : device(platform) { }
+	};
+
+	Constructible<Display> _display_dev { };
+
+	bool _ic_busy { false };
+
+	/*
+	 * Returns false while the image converter still reads the previous
+	 * frame from the capture buffer
+	 */
+	bool _ic_idle()
+	{
+		if (!_ic_busy)
+			return true;
+
+		if (!_display_dev->ipu.ic_done())
+			return false;
+
+		_display_dev->ipu.ic_finish();
+		_ic_busy = false;
+		return true;
+	}
+
+	void _scale_captured()
+	{
+		Ipu::Ic_task const task {
+			.format     = Ipu::Ic_task::RGB32,
+			.src_phys   = _capture_buf->dma_addr(),
+			.src_width  = (uint16_t)_capture_size.w(),
+			.src_height = (uint16_t)_capture_size.h(),
+			.src_stride = (uint32_t)(_capture_size.w() * BYTES_PER_PIXEL),
+			.dst_phys   = _fb_buf.dma_addr(),
+			.dst_width  = (uint16_t)_size.w(),
+			.dst_height = (uint16_t)_size.h(),
+			.dst_stride = (uint32_t)(_size.w() * BYTES_PER_PIXEL) };
+
+		/* the IC reads the frame from memory */
+		cache_clean_invalidate_data((addr_t)_capture_buf->local_addr<void>(),
+		                            _capture_size.count()*sizeof(Pixel));
+
+		_ic_busy = _display_dev->ipu.ic_start(task);
+	}
+
+	/*
+	 * Adaptive polling of the capture session
+	 *
+	 * After 'idle_captures' consecutive captures without any change, the
+	 * polling period gets doubled up to 'max_period_us'. Any damage,
+	 * including pointer motion, immediately restores the base period.
+	 */
+	uint64_t _period_us     { 10*1000 };
+	uint64_t _max_period_us { 160*1000 };
+	unsigned _idle_captures { 8 };
+	uint64_t _cur_period_us { 0 };
+	unsigned _unchanged     { 0 };
+
+	void _apply_period(uint64_t us)
+	{
+		if (us == _cur_period_us)
+			return;
+
+		_cur_period_us = us;
+		_timer.trigger_periodic(us);
+	}
 
 	void _handle_timer()
 	{
-		Surface<Pixel> surface(_fb_buf.local_addr<Pixel>(), _size);
-		_captured_screen.apply_to_surface(surface);
+		/* leave the damage to the next period while the IC is busy */
+		if (_scale && !_ic_idle())
+			return;
+
+		Pixel * const pixels = _scale ? _capture_buf->local_addr<Pixel>()
+		                              : _fb_buf.local_addr<Pixel>();
+
+		Surface<Pixel> surface(pixels, _capture_size);
+		Capture::Rect const damage = _captured_screen.apply_to_surface(surface);
+
+		if (damage.valid() && _scale && _display_dev.constructed())
+			_scale_captured();
+
+		if (damage.valid()) {
+			_unchanged = 0;
+			_apply_period(_period_us);
+			return;
+		}
+
+		if (++_unchanged < _idle_captures)
+			return;
+
+		_unchanged = 0;
+		_apply_period(min(_cur_period_us*2, _max_period_us));
+	}
+
+	/*
+	 * A running conversion completes within a frame time. If the IC does
+	 * not report completion within a few frame times, the task is stopped
+	 * anyway before the device gets released.
+	 */
+	void _wait_for_ic()
+	{
+		enum { ATTEMPTS = 50, DELAY_US = 1000 };
+
+		for (unsigned i = 0; !_ic_idle(); i++) {
+
+			if (i == ATTEMPTS) {
+				warning("image converter did not complete, stopping it");
+				_display_dev->ipu.ic_finish();
+				_ic_busy = false;
+				return;
+			}
+			_timer.usleep(DELAY_US);
+		}
 	}
 
-	enum Resolutions { BYTES_PER_PIXEL  = 4 };
+	void _blank(bool blank)
+	{
+		if (blank == !_display_dev.constructed())
+			return;
+
+		if (blank) {
+			_timer.trigger_periodic(0);
+			_cur_period_us = 0;
+
+			_wait_for_ic();
+
+			_display_dev.destruct();
+			return;
+		}
+
+		_display_dev.construct(_platform);
+		_display_dev->ipu.init(_size.w(), _size.h(), _size.w() * BYTES_PER_PIXEL,
+		                       _fb_buf.dma_addr(), _disp == 0);
+
+		_unchanged = 0;
+		_apply_period(_period_us);
+	}
+
+	void _handle_config()
+	{
+		_config.update();
+		Xml_node const config = _config.xml();
+
+		_period_us     = 1000*max(1U, config.attribute_value("period_ms", 10U));
+		_max_period_us = 1000*config.attribute_value("max_period_ms", 160U);
+		_idle_captures = max(1U, config.attribute_value("idle_captures", 8U));
+		_max_period_us = max(_max_period_us, _period_us);
+
+		bool const blank = config.attribute_value("dpms", String<8>("on")) == "off";
+
+		if (!blank && _display_dev.constructed()) {
+			_unchanged = 0;
+			_apply_period(_period_us);
+		}
+
+		_blank(blank);
+	}
 
 	Main(Env &env) : _env(env)
 	{
 		log("--- i.MX53 framebuffer driver ---");
 
-		_ipu.init(_size.w(), _size.h(), _size.w() * BYTES_PER_PIXEL,
-		          _fb_buf.dma_addr(), _disp == 0);
+		if (_scale) {
+			_capture_buf.construct(_platform,
+			                       _capture_size.count()*sizeof(Pixel), CACHED);
+			log("scaling ", _capture_size, " to ", _size, " via the IPU image converter");
+		}
 
 		_timer.sigh(_timer_handler);
-		_timer.trigger_periodic(10*1000);
+		_config.sigh(_config_handler);
+		_handle_config();
 	}
 };
 
@@ -11,6 +11,7 @@
  * version 2.
  */
 
+#include <linux/errno.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/fb.h>
@@ -51,9 +52,33 @@ struct fb_info * framebuffer_alloc(size_t size,struct device * dev)
 }
 
 
+static struct fb_info *registered_fb_info;
+
+
 int register_framebuffer(struct fb_info * fb_info)
 {
+	registered_fb_info = fb_info;
+
 	lx_emul_framebuffer_ready(fb_info->screen_base, fb_info->screen_size,
 	                          fb_info->var.xres, fb_info->var.yres);
+
+	/* apply a DPMS state requested before the framebuffer existed */
+	lx_emul_framebuffer_dpms_update();
+	return 0;
+}
+
+
+/*
+ * Must be called from within a kernel task, because the DRM helper
+ * takes the modeset locks when disabling or re-enabling the CRTC
+ */
+int lx_emul_framebuffer_blank(int blank)
+{
+	struct fb_info * const info = registered_fb_info;
+
+	if (!info || !info->fbops || !info->fbops->fb_blank)
+		return -ENODEV;
+
+	info->fbops->fb_blank(blank ? FB_BLANK_POWERDOWN : FB_BLANK_UNBLANK, info);
 	return 0;
 }
@@ -21,6 +21,25 @@ extern "C" {
 void lx_emul_framebuffer_ready(void * base, unsigned long size,
                                unsigned xres, unsigned yres);
 
+/**
+ * Request the display power state, 'blank' selects DPMS off
+ *
+ * The state change is executed asynchronously by a kernel task.
+ */
+void lx_emul_framebuffer_dpms(int blank);
+
+/**
+ * Re-apply the requested display power state, e.g., after registration
+ */
+void lx_emul_framebuffer_dpms_update(void);
+
+/**
+ * Blank or unblank the registered framebuffer from kernel-task context
+ *
+ * \return  0 on success, or -ENODEV if no framebuffer is registered yet
+ */
+int lx_emul_framebuffer_blank(int blank);
+
 #ifdef __cplusplus
 }
 #endif
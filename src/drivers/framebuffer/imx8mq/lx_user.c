@@ -11,6 +11,60 @@
  * version 2.
  */
 
+#include <linux/kthread.h>
+#include <linux/sched/task.h>
+#include <lx_emul/fb.h>
+#include <lx_emul/task.h>
 #include <lx_user/init.h>
 
-void lx_user_init(void) {}
+static struct task_struct *dpms_task;
+
+static int dpms_requested = 0;
+static int dpms_current   = 0;
+
+
+static int dpms_task_function(void *arg)
+{
+	for (;;) {
+
+		/*
+		 * Disabling the CRTC lets the DRM drivers switch off the pixel
+		 * clock (lcdif_pixel_clk_root resp. display_hdmi_clk_root) and
+		 * the display pipeline, re-enabling restores the last mode.
+		 */
+		while (dpms_current != dpms_requested) {
+			int const blank = dpms_requested;
+
+			/* retried by 'register_framebuffer' */
+			if (lx_emul_framebuffer_blank(blank))
+				break;
+
+			dpms_current = blank;
+		}
+
+		/* block until lx_emul_task_unblock */
+		lx_emul_task_schedule(true);
+	}
+	return 0;
+}
+
+
+void lx_emul_framebuffer_dpms_update(void)
+{
+	if (dpms_task)
+		lx_emul_task_unblock(dpms_task);
+}
+
+
+void lx_emul_framebuffer_dpms(int blank)
+{
+	dpms_requested = !!blank;
+	lx_emul_framebuffer_dpms_update();
+}
+
+
+void lx_user_init(void)
+{
+	pid_t pid = kernel_thread(dpms_task_function, NULL, CLONE_FS | CLONE_FILES);
+	dpms_task = find_task_by_pid_ns(pid, NULL);
+}
@@ -33,6 +33,7 @@ struct Framebuffer::Driver
 	Env                  & env;
 	Timer::Connection      timer   { env };
 	Attached_rom_dataspace dtb_rom { env, "dtb" };
+	Attached_rom_dataspace config  { env, "config" };
 
 	class Fb
 	{
@@ -51,11 +52,14 @@ struct Framebuffer::Driver
 
 		public:
 
-			void paint()
+			/**
+			 * Return true if the captured screen changed
+			 */
+			bool paint()
 			{
 				using Pixel = Capture::Pixel;
 				Surface<Pixel> surface((Pixel*)_base, _size);
-				_captured_screen.apply_to_surface(surface);
+				return _captured_screen.apply_to_surface(surface).valid();
 			}
 
 			Fb(Env & env, void * base, unsigned xres, unsigned yres)
@@ -68,14 +72,81 @@ struct Framebuffer::Driver
 
 	Constructible<Fb> fb {};
 
+	/*
+	 * Adaptive polling of the capture session
+	 *
+	 * After 'idle_captures' consecutive unchanged captures the period is
+	 * doubled up to 'max_period_ms', any damage (including pointer motion)
+	 * restores the base period immediately.
+	 */
+	uint64_t period_us     { 20*1000 };
+	uint64_t max_period_us { 160*1000 };
+	unsigned idle_captures { 8 };
+	uint64_t cur_period_us { 0 };
+	unsigned unchanged     { 0 };
+	bool     blanked       { false };
+
+	void apply_period(uint64_t us)
+	{
+		if (us == cur_period_us)
+			return;
+
+		cur_period_us = us;
+		timer.trigger_periodic(us);
+	}
+
 	void handle_timer()
 	{
-		if (fb.constructed()) { fb->paint(); }
+		if (!fb.constructed() || blanked)
+			return;
+
+		if (fb->paint()) {
+			unchanged = 0;
+			apply_period(period_us);
+			return;
+		}
+
+		if (++unchanged < idle_captures)
+			return;
+
+		unchanged = 0;
+		apply_period(min(cur_period_us*2, max_period_us));
 	}
 
 	Signal_handler<Driver> timer_handler { env.ep(), *this,
 	                                       &Driver::handle_timer };
 
+	void handle_config()
+	{
+		config.update();
+		Xml_node const node = config.xml();
+
+		period_us     = 1000*max(1U, node.attribute_value("period_ms", 20U));
+		max_period_us = 1000*node.attribute_value("max_period_ms", 160U);
+		idle_captures = max(1U, node.attribute_value("idle_captures", 8U));
+		max_period_us = max(max_period_us, period_us);
+
+		bool const blank = node.attribute_value("dpms", String<8>("on")) == "off";
+
+		if (blank != blanked) {
+			blanked = blank;
+			lx_emul_framebuffer_dpms(blank);
+			Lx_kit::env().scheduler.schedule();
+		}
+
+		if (blanked) {
+			timer.trigger_periodic(0);
+			cur_period_us = 0;
+			return;
+		}
+
+		unchanged = 0;
+		apply_period(period_us);
+	}
+
+	Signal_handler<Driver> config_handler { env.ep(), *this,
+	                                        &Driver::handle_config };
+
 	Driver(Env & env) : env(env)
 	{
 		Lx_kit::initialize(env);
@@ -89,7 +160,8 @@ struct Framebuffer::Driver
 		lx_emul_start_kernel(dtb_rom.local_addr<void>());
 
 		timer.sigh(timer_handler);
-		timer.trigger_periodic(20*1000);
+		config.sigh(config_handler);
+		handle_config();
 	}
 };
 
@@ -61,60 +61,6 @@ void * dmam_alloc_attrs(struct device * dev,size_t size,dma_addr_t * dma_handle,
 }
 
 
-dma_addr_t dma_map_page_attrs(struct device * dev,
-                              struct page * page,
-                              size_t offset,
-                              size_t size,
-                              enum dma_data_direction dir,
-                              unsigned long attrs)
-{
-	dma_addr_t    const dma_addr  = page_to_phys(page);
-	unsigned long const virt_addr = (unsigned long)page_to_virt(page);
-
-	lx_emul_mem_cache_clean_invalidate((void *)(virt_addr + offset), size);
-	return dma_addr + offset;
-}
-
-
-void dma_unmap_page_attrs(struct device * dev,
-                          dma_addr_t addr,
-                          size_t size,
-                          enum dma_data_direction dir,
-                          unsigned long attrs)
-{
-	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
-
-	if (!virt_addr)
-		return;
-
-	if (dir == DMA_FROM_DEVICE)
-		lx_emul_mem_cache_invalidate((void *)virt_addr, size);
-}
-
-
-void dma_sync_single_for_cpu(struct device *dev, dma_addr_t addr,
-                             size_t size, enum dma_data_direction dir)
-{
-	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
-
-	if (!virt_addr)
-		return;
-
-	lx_emul_mem_cache_invalidate((void *)virt_addr, size);
-}
-
-
-void dma_sync_single_for_device(struct device * dev,dma_addr_t addr,size_t size,enum dma_data_direction dir)
-{
-	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
-
-	if (!virt_addr)
-		return;
-
-	lx_emul_mem_cache_clean_invalidate((void *)virt_addr, size);
-}
-
-
 int dma_supported(struct device * dev,u64 mask)
 {
 	lx_emul_trace(__func__);
@@ -166,16 +112,116 @@ void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 
 
 #include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/page_ref.h>
+#include <lx_emul/page_virt.h>
+
+/*
+ * Page-fragment cache
+ *
+ * Fragments are carved top-down out of chunks of PAGE_FRAG_CACHE_MAX_SIZE,
+ * which are naturally aligned so that the chunk of a fragment is found by
+ * masking its address. The reference counter of the chunk's first page
+ * tracks the fragments in use, whereby the cache holds a bias of references
+ * to avoid touching the counter on each allocation. Released chunks are
+ * kept in a small recycling pool, so that the RX path, which allocates and
+ * frees one fragment per packet, does not hit the memory allocator.
+ */
+
+enum { PAGE_FRAG_RECYCLE_MAX = 16 };
+
+static void * page_frag_recycled[PAGE_FRAG_RECYCLE_MAX];
+static unsigned page_frag_recycled_count;
+
+
+static void * page_frag_chunk_alloc(void)
+{
+	void *va;
+
+	if (page_frag_recycled_count)
+		return page_frag_recycled[--page_frag_recycled_count];
+
+	va = lx_emul_mem_alloc_aligned(PAGE_FRAG_CACHE_MAX_SIZE,
+	                               PAGE_FRAG_CACHE_MAX_SIZE);
+	if (va)
+		lx_emul_virt_to_pages(va, PAGE_FRAG_CACHE_MAX_SIZE >> PAGE_SHIFT);
+
+	return va;
+}
+
+
+static void page_frag_chunk_free(void *va)
+{
+	if (page_frag_recycled_count < PAGE_FRAG_RECYCLE_MAX) {
+		page_frag_recycled[page_frag_recycled_count++] = va;
+		return;
+	}
+
+	lx_emul_forget_pages(va, PAGE_FRAG_CACHE_MAX_SIZE);
+	lx_emul_mem_free(va);
+}
+
+
+static void * page_frag_chunk(void const *addr)
+{
+	return (void *)((unsigned long)addr & ~(PAGE_FRAG_CACHE_MAX_SIZE - 1UL));
+}
+
+
+static struct page * page_frag_chunk_page(void const *addr)
+{
+	return virt_to_page(page_frag_chunk(addr));
+}
+
 
 void * page_frag_alloc(struct page_frag_cache * nc,unsigned int fragsz,gfp_t gfp_mask)
 {
-	return lx_emul_mem_alloc_aligned(fragsz, ARCH_KMALLOC_MINALIGN);
+	unsigned int const bias = PAGE_FRAG_CACHE_MAX_SIZE + 1;
+	int offset;
+
+	if (unlikely(fragsz > PAGE_FRAG_CACHE_MAX_SIZE))
+		return NULL;
+
+	if (unlikely(!nc->va)) {
+refill:
+		nc->va = page_frag_chunk_alloc();
+		if (!nc->va)
+			return NULL;
+
+		set_page_count(page_frag_chunk_page(nc->va), bias);
+		nc->pagecnt_bias = bias;
+		nc->offset       = PAGE_FRAG_CACHE_MAX_SIZE;
+	}
+
+	/* keep fragments apart at the granularity of DMA cache maintenance */
+	offset = ((int)nc->offset - (int)fragsz) & ~(ARCH_KMALLOC_MINALIGN - 1);
+
+	if (unlikely(offset < 0)) {
+		struct page * const page = page_frag_chunk_page(nc->va);
+
+		/* drop the references not handed out, retire chunk if still in use */
+		if (!page_ref_sub_and_test(page, nc->pagecnt_bias))
+			goto refill;
+
+		/* all fragments got freed already, reuse the chunk right away */
+		set_page_count(page, bias);
+		nc->pagecnt_bias = bias;
+		offset = (PAGE_FRAG_CACHE_MAX_SIZE - fragsz) & ~(ARCH_KMALLOC_MINALIGN - 1);
+	}
+
+	nc->pagecnt_bias--;
+	nc->offset = offset;
+
+	return nc->va + offset;
 }
 
 
 void page_frag_free(void * addr)
 {
-	lx_emul_mem_free(addr);
+	struct page * const page = page_frag_chunk_page(addr);
+
+	if (page_ref_dec_and_test(page))
+		page_frag_chunk_free(page_frag_chunk(addr));
 }
 
 
@@ -11,12 +11,548 @@
  * version 2.
  */
 
+#include <linux/ethtool.h>
+#include <linux/if_vlan.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/kthread.h>
 #include <linux/netdevice.h>
 #include <linux/rtnetlink.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <asm/unaligned.h>
+#include <lx_emul/task.h>
 #include <lx_user/init.h>
 #include <genode_c_api/uplink.h>
 
+#include <lx_user.h>
+
+#include <fec.h>
+
+
+enum { TX_BATCH_DEFAULT = 64 };
+
+static struct lx_user_nic_config nic_config;
+static bool                      nic_config_pending;
+
+
+void lx_user_configure(struct lx_user_nic_config const *config)
+{
+	nic_config         = *config;
+	nic_config_pending = true;
+}
+
+
+/*
+ * Statistics
+ *
+ * Counters are updated by the user task and the RX handler, both running
+ * within the Linux task context. A snapshot is taken on request by the
+ * user task, so the Genode side reads a consistent state.
+ */
+
+enum { MAX_NICS = 2 };
+
+struct nic_stats
+{
+	struct net_device        *dev;
+	struct lx_user_nic_stats  live;
+	struct lx_user_nic_stats  snapshot;
+	char                     *mib_names;
+	u64                      *mib_values;
+	unsigned                  ptp_adjust;  /* last clock step applied */
+};
+
+static struct nic_stats nic_stats[MAX_NICS];
+static bool             nic_stats_pending;
+
+
+void lx_user_stats_request(void)
+{
+	nic_stats_pending = true;
+}
+
+
+void lx_user_for_each_nic_stats(void (*fn)(struct lx_user_nic_stats const *, void *),
+                                void *data)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_NICS && nic_stats[i].dev; i++)
+		fn(&nic_stats[i].snapshot, data);
+}
+
+
+static struct nic_stats *dev_nic_stats(struct net_device *dev)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_NICS; i++) {
+
+		if (nic_stats[i].dev == dev)
+			return &nic_stats[i];
+
+		if (!nic_stats[i].dev) {
+			nic_stats[i].dev = dev;
+			return &nic_stats[i];
+		}
+	}
+	return NULL;
+}
+
+
+static struct lx_user_nic_stats *dev_stats(struct net_device *dev)
+{
+	/* counters of surplus devices are discarded */
+	static struct lx_user_nic_stats surplus;
+
+	struct nic_stats * const nic = dev_nic_stats(dev);
+
+	return nic ? &nic->live : &surplus;
+}
+
+
+/*
+ * Number of TX descriptors handed to the controller but not yet reclaimed
+ */
+static unsigned tx_ring_used(struct fec_enet_priv_tx_q const *txq)
+{
+	int free = (((char const *)txq->dirty_tx - (char const *)txq->bd.cur)
+	            >> txq->bd.dsize_log2) - 1;
+
+	if (free < 0)
+		free += txq->bd.ring_size;
+
+	return txq->bd.ring_size - 1 - free;
+}
+
+
+static unsigned tx_rings_used(struct net_device *dev)
+{
+	struct fec_enet_private const *fep = netdev_priv(dev);
+	unsigned i, used = 0;
+
+	for (i = 0; i < fep->num_tx_queues; i++)
+		used += tx_ring_used(fep->tx_queue[i]);
+
+	return used;
+}
+
+
+static void sample_tx_rings(struct net_device *dev, struct lx_user_nic_stats *stats)
+{
+	unsigned const used = tx_rings_used(dev);
+
+	if (used > stats->tx_ring_used_max)
+		stats->tx_ring_used_max = used;
+}
+
+
+static void snapshot_mib(struct net_device *dev, struct nic_stats *nic)
+{
+	struct ethtool_ops const * const ops = dev->ethtool_ops;
+	struct ethtool_stats estats;
+	int count;
+
+	if (!ops || !ops->get_sset_count || !ops->get_strings ||
+	    !ops->get_ethtool_stats)
+		return;
+
+	if (!nic->mib_names) {
+		count = ops->get_sset_count(dev, ETH_SS_STATS);
+		if (count <= 0)
+			return;
+
+		nic->mib_names  = kcalloc(count, ETH_GSTRING_LEN, GFP_KERNEL);
+		nic->mib_values = kcalloc(count, sizeof(u64), GFP_KERNEL);
+		if (!nic->mib_names || !nic->mib_values) {
+			kfree(nic->mib_names);
+			kfree(nic->mib_values);
+			nic->mib_names  = NULL;
+			nic->mib_values = NULL;
+			return;
+		}
+
+		ops->get_strings(dev, ETH_SS_STATS, nic->mib_names);
+		nic->live.mib_count = count;
+	}
+
+	estats.n_stats = nic->live.mib_count;
+	ops->get_ethtool_stats(dev, &estats, nic->mib_values);
+}
+
+
+static void snapshot_stats(struct net_device *dev)
+{
+	struct fec_enet_private const *fep = netdev_priv(dev);
+	struct nic_stats *nic = dev_nic_stats(dev);
+	struct lx_user_nic_stats *live;
+	unsigned i;
+
+	if (!nic)
+		return;
+
+	live = &nic->live;
+
+	snapshot_mib(dev, nic);
+
+	live->name         = &dev->name[0];
+	live->link         = netif_carrier_ok(dev);
+	live->tx_ring_used = tx_rings_used(dev);
+	live->tx_ring_size = 0;
+
+	for (i = 0; i < fep->num_tx_queues; i++)
+		live->tx_ring_size += fep->tx_queue[i]->bd.ring_size;
+
+	live->mib_names  = nic->mib_names;
+	live->mib_values = nic->mib_values;
+
+	nic->snapshot = *live;
+
+	/* the high-water mark covers the period between two snapshots */
+	live->tx_ring_used_max = live->tx_ring_used;
+}
+
+
+/*
+ * Mapping of frame priorities to the TX queues of the controller
+ *
+ * The mapping corresponds to the one the FEC uses for VLAN priorities.
+ * Queue 0 is the best-effort queue, queues 1 and 2 are the AVB queues with
+ * credit-based shaping, which are served independently from queue 0.
+ */
+static u8 const prio_to_queue[8] = { 0, 0, 1, 1, 1, 2, 2, 2 };
+
+
+static void setup_tx_classes(struct net_device *dev)
+{
+	unsigned const queues = dev->real_num_tx_queues;
+	unsigned tc, prio;
+
+	if (!nic_config.classify || queues < 2) {
+		netdev_reset_tc(dev);
+		return;
+	}
+
+	/*
+	 * With traffic classes defined, the default queue selection picks the
+	 * TX queue via 'skb->priority', one queue per traffic class
+	 */
+	netdev_set_num_tc(dev, queues);
+
+	for (tc = 0; tc < queues; tc++)
+		netdev_set_tc_queue(dev, tc, 1, tc);
+
+	for (prio = 0; prio < ARRAY_SIZE(prio_to_queue); prio++)
+		netdev_set_prio_tc_map(dev, prio, min_t(unsigned, prio_to_queue[prio],
+		                                        queues - 1));
+}
+
+
+/*
+ * Determine the priority of an outbound frame
+ *
+ * Tagged frames use the VLAN PCP, untagged IPv4/IPv6 frames the class
+ * selector (upper three bits) of the DSCP.
+ */
+static u32 frame_priority(unsigned char const *frame, unsigned long len)
+{
+	__be16 proto;
+
+	if (len < VLAN_ETH_HLEN)
+		return 0;
+
+	proto = get_unaligned((__be16 const *)(frame + 12));
+
+	if (proto == htons(ETH_P_8021Q)) {
+		u16 const tci = get_unaligned_be16(frame + ETH_HLEN);
+		return (tci & VLAN_PRIO_MASK) >> VLAN_PRIO_SHIFT;
+	}
+
+	if (proto == htons(ETH_P_IP))
+		return frame[ETH_HLEN + 1] >> 5;
+
+	if (proto == htons(ETH_P_IPV6))
+		return (frame[ETH_HLEN] & 0x0f) >> 1;
+
+	return 0;
+}
+
+
+/*
+ * Let the controller insert the checksums of an outbound IPv4 frame
+ *
+ * With 'checksum_offload' enabled, the FEC computes the TCP or UDP and the
+ * IPv4 header checksum of each non-fragmented IPv4 TCP/UDP frame, whatever
+ * the sender filled in. The driver zeroes both fields before handing the
+ * frame to the controller. So senders attached to the uplink may skip the
+ * checksum computation.
+ */
+static void request_tx_checksum(struct sk_buff *skb)
+{
+	struct iphdr *iph;
+	unsigned ihl, l4, csum_offset, l4_len;
+
+	if (!(skb->dev->features & NETIF_F_IP_CSUM))
+		return;
+
+	if (skb->len < ETH_HLEN + sizeof(*iph) ||
+	    eth_hdr(skb)->h_proto != htons(ETH_P_IP))
+		return;
+
+	iph = (struct iphdr *)(skb->data + ETH_HLEN);
+	ihl = iph->ihl * 4;
+
+	if (iph->version != 4 || ihl < sizeof(*iph))
+		return;
+
+	/* the L4 checksum of a fragmented datagram spans all fragments */
+	if (iph->frag_off & htons(IP_MF | IP_OFFSET))
+		return;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		csum_offset = offsetof(struct tcphdr, check);
+		l4_len      = sizeof(struct tcphdr);
+		break;
+	case IPPROTO_UDP:
+		csum_offset = offsetof(struct udphdr, check);
+		l4_len      = sizeof(struct udphdr);
+		break;
+	default:
+		return;
+	}
+
+	l4 = ETH_HLEN + ihl;
+	if (skb->len < l4 + l4_len || ntohs(iph->tot_len) > skb->len - ETH_HLEN)
+		return;
+
+	skb->protocol = htons(ETH_P_IP);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb_set_transport_header(skb, l4);
+	skb->ip_summed   = CHECKSUM_PARTIAL;
+	skb->csum_start  = skb_headroom(skb) + l4;
+	skb->csum_offset = csum_offset;
+}
+
+
+/*
+ * IEEE 1588 time stamps
+ *
+ * Time stamps of PTP event messages are kept in a ring until the Genode
+ * side picks them up at the end of the current I/O-progress round. When
+ * the ring overflows, the oldest records are replaced.
+ */
+
+enum { PTP_EVENT_PORT = 319, PTP_HEADER_LEN = 34, PTP_RING_SIZE = 64 };
+
+static struct lx_user_ptp_timestamp ptp_ring[PTP_RING_SIZE];
+static unsigned                     ptp_head, ptp_count;
+
+
+bool lx_user_ptp_pending(void)
+{
+	return ptp_count > 0;
+}
+
+
+void lx_user_for_each_ptp_timestamp(void (*fn)(struct lx_user_ptp_timestamp const *, void *),
+                                    void *data)
+{
+	for (; ptp_count; ptp_count--)
+		fn(&ptp_ring[(ptp_head - ptp_count) % PTP_RING_SIZE], data);
+}
+
+
+/*
+ * Locate the header of a PTP event message carried directly over Ethernet
+ * or over UDP/IPv4 or UDP/IPv6
+ *
+ * Only event messages (Sync, Delay_Req, Pdelay_Req, Pdelay_Resp) are time
+ * stamped, general messages are ignored.
+ */
+static unsigned char const *ptp_event_header(unsigned char const *frame,
+                                             unsigned long len)
+{
+	unsigned long off = ETH_HLEN;
+	u16 proto;
+
+	if (len < ETH_HLEN)
+		return NULL;
+
+	proto = get_unaligned_be16(frame + 12);
+
+	if (proto == ETH_P_8021Q) {
+		if (len < VLAN_ETH_HLEN)
+			return NULL;
+		proto = get_unaligned_be16(frame + 16);
+		off   = VLAN_ETH_HLEN;
+	}
+
+	switch (proto) {
+	case ETH_P_1588:
+		break;
+
+	case ETH_P_IP:
+		if (len < off + sizeof(struct iphdr) ||
+		    frame[off + 9] != IPPROTO_UDP ||
+		    (get_unaligned_be16(frame + off + 6) & IP_OFFSET))
+			return NULL;
+		off += (frame[off] & 0xf) * 4;
+		goto udp;
+
+	case ETH_P_IPV6:
+		if (len < off + sizeof(struct ipv6hdr) ||
+		    frame[off + 6] != IPPROTO_UDP)
+			return NULL;
+		off += sizeof(struct ipv6hdr);
+		goto udp;
+
+	default:
+		return NULL;
+	}
+
+	goto ptp;
+
+udp:
+	if (len < off + sizeof(struct udphdr) ||
+	    get_unaligned_be16(frame + off + 2) != PTP_EVENT_PORT)
+		return NULL;
+	off += sizeof(struct udphdr);
+
+ptp:
+	if (len < off + PTP_HEADER_LEN || (frame[off] & 0xf) > 3)
+		return NULL;
+
+	return frame + off;
+}
+
+
+static void ptp_record(struct net_device *dev, bool tx,
+                       unsigned char const *frame, unsigned long len,
+                       ktime_t hwtstamp)
+{
+	unsigned char const * const hdr = ptp_event_header(frame, len);
+	struct lx_user_ptp_timestamp *ts;
+
+	if (!hdr || !hwtstamp)
+		return;
+
+	ts = &ptp_ring[ptp_head % PTP_RING_SIZE];
+
+	ts->nic      = &dev->name[0];
+	ts->tx       = tx;
+	ts->type     = hdr[0] & 0xf;
+	ts->domain   = hdr[4];
+	ts->sequence = get_unaligned_be16(hdr + 30);
+	ts->ns       = ktime_to_ns(hwtstamp);
+
+	ptp_head++;
+	if (ptp_count < PTP_RING_SIZE)
+		ptp_count++;
+}
+
+
+/*
+ * Enable time stamping and adjust the hardware clock of the controller
+ *
+ * The settings correspond to those of the SIOCSHWTSTAMP ioctl and the
+ * PTP clock device. Controllers without the 1588 timer (no extended
+ * buffer descriptors) are left alone.
+ */
+static void apply_ptp_config(struct net_device *dev)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+	struct nic_stats *nic = dev_nic_stats(dev);
+	bool step;
+
+	if (!fep->bufdesc_ex)
+		return;
+
+	fep->hwts_rx_en = nic_config.ptp;
+	fep->hwts_tx_en = nic_config.ptp;
+
+	/*
+	 * The clock step is a one-shot action, applied only on a change of the
+	 * 'ptp_adjust' sequence number, not on each configuration update. A
+	 * change while time stamping is disabled is consumed without stepping.
+	 */
+	step = nic && nic->ptp_adjust != nic_config.ptp_adjust;
+
+	if (nic)
+		nic->ptp_adjust = nic_config.ptp_adjust;
+
+	if (!nic_config.ptp)
+		return;
+
+	/* the frequency correction is reset along with the controller */
+	if (fep->ptp_caps.adjfreq)
+		fep->ptp_caps.adjfreq(&fep->ptp_caps, nic_config.ptp_freq_ppb);
+
+	if (step && nic_config.ptp_step_ns && fep->ptp_caps.adjtime)
+		fep->ptp_caps.adjtime(&fep->ptp_caps, nic_config.ptp_step_ns);
+}
+
+
+/*
+ * Program the hardware interrupt coalescing (ICTT/ICFT) and the NAPI
+ * budget according to the driver configuration
+ */
+static void apply_nic_config(struct net_device *dev)
+{
+	struct ethtool_ops const * const ops = dev->ethtool_ops;
+	struct ethtool_coalesce ec;
+	struct napi_struct *napi;
+
+	if (nic_config.napi_weight)
+		list_for_each_entry(napi, &dev->napi_list, dev_list)
+			napi->weight = nic_config.napi_weight;
+
+	/*
+	 * With checksum offload, the controller discards received IPv4 frames
+	 * with a bad header, TCP or UDP checksum. So receivers attached to the
+	 * uplink may skip the verification of frames passed to them.
+	 */
+	if (nic_config.checksum_offload && (dev->hw_features & NETIF_F_RXCSUM)
+	 && !(dev->features & NETIF_F_RXCSUM)) {
+		dev->wanted_features |= NETIF_F_RXCSUM;
+		netdev_update_features(dev);
+	}
+
+	if (nic_config.checksum_offload && !(dev->features & NETIF_F_RXCSUM))
+		printk("%s: no hardware checksum verification\n", &dev->name[0]);
+
+	setup_tx_classes(dev);
+	apply_ptp_config(dev);
+
+	if (!nic_config.rx_coalesce_usecs && !nic_config.rx_coalesce_frames &&
+	    !nic_config.tx_coalesce_usecs && !nic_config.tx_coalesce_frames)
+		return;
+
+	if (!ops || !ops->get_coalesce || !ops->set_coalesce)
+		return;
+
+	memset(&ec, 0, sizeof(ec));
+	if (ops->get_coalesce(dev, &ec))
+		return;
+
+	if (nic_config.rx_coalesce_usecs)
+		ec.rx_coalesce_usecs = nic_config.rx_coalesce_usecs;
+	if (nic_config.rx_coalesce_frames)
+		ec.rx_max_coalesced_frames = nic_config.rx_coalesce_frames;
+	if (nic_config.tx_coalesce_usecs)
+		ec.tx_coalesce_usecs = nic_config.tx_coalesce_usecs;
+	if (nic_config.tx_coalesce_frames)
+		ec.tx_max_coalesced_frames = nic_config.tx_coalesce_frames;
+
+	{
+		int const err = ops->set_coalesce(dev, &ec);
+		if (err)
+			printk("%s: interrupt coalescing not applied (%d)\n",
+			       &dev->name[0], err);
+	}
+}
+
 
 static struct genode_uplink *dev_genode_uplink(struct net_device *dev)
 {
@@ -26,13 +562,15 @@ static struct genode_uplink *dev_genode_uplink(struct net_device *dev)
 
 struct genode_uplink_rx_context
 {
-	struct net_device *dev;
+	struct net_device        *dev;
+	struct lx_user_nic_stats *stats;
 };
 
 
 struct genode_uplink_tx_packet_context
 {
-	struct sk_buff *skb;
+	struct sk_buff           *skb;
+	struct lx_user_nic_stats *stats;
 };
 
 
@@ -44,15 +582,20 @@ static unsigned long uplink_tx_packet_content(struct genode_uplink_tx_packet_con
 	skb_push(skb, ETH_HLEN);
 
 	if (dst_len < skb->len) {
-		printk("uplink_tx_packet_content: packet exceeds uplink packet size\n");
-		memset(dst, 0, dst_len);
+		dev_stats(skb->dev)->rx_oversized++;
 		return 0;
 	}
 
-	skb_copy_from_linear_data(skb, dst, skb->len);
+	/*
+	 * The uplink truncates the packet to the returned size, hence the
+	 * unused part of the destination buffer is left untouched. Copying via
+	 * 'skb_copy_bits' covers frames that got split into page fragments.
+	 */
+	if (skb_copy_bits(skb, 0, dst, skb->len))
+		return 0;
 
-	/* clear unused part of the destination buffer */
-	memset(dst + skb->len, 0, dst_len - skb->len);
+	ctx->stats->rx_packets++;
+	ctx->stats->rx_bytes += skb->len;
 
 	return skb->len;
 }
@@ -62,17 +605,26 @@ static rx_handler_result_t handle_rx(struct sk_buff **pskb)
 {
 	struct sk_buff *skb = *pskb;
 	struct net_device *dev = skb->dev;
-	struct genode_uplink_tx_packet_context ctx = { .skb = skb };
+	struct genode_uplink_tx_packet_context ctx = { .skb   = skb,
+	                                               .stats = dev_stats(dev) };
+
+	if (nic_config.ptp)
+		ptp_record(dev, false, skb_mac_header(skb),
+		           skb->len + (skb->data - skb_mac_header(skb)),
+		           skb_hwtstamps(skb)->hwtstamp);
 
 	{
 		bool progress = genode_uplink_tx_packet(dev_genode_uplink(dev),
 		                                        uplink_tx_packet_content,
 		                                        &ctx);
-		if (!progress)
-			printk("handle_rx: uplink saturated, dropping packet\n");
+		if (!progress) {
+			ctx.stats->rx_uplink_full++;
+			kfree_skb(skb);
+			return RX_HANDLER_CONSUMED;
+		}
 	}
 
-	kfree_skb(skb);
+	consume_skb(skb);
 	return RX_HANDLER_CONSUMED;
 }
 
@@ -110,6 +662,9 @@ static void handle_create_uplink(struct net_device *dev)
 	args.label = &dev->name[0];
 
 	dev->ifalias = (struct dev_ifalias *)genode_uplink_create(&args);
+
+	/* the controller got re-initialized on link up */
+	apply_nic_config(dev);
 }
 
 
@@ -132,57 +687,148 @@ static void handle_destroy_uplink(struct net_device *dev)
 static genode_uplink_rx_result_t uplink_rx_one_packet(struct genode_uplink_rx_context *ctx,
                                                       char const *ptr, unsigned long len)
 {
-	struct sk_buff *skb = alloc_skb(len, GFP_KERNEL);
+	/*
+	 * The packet-stream buffer is not DMA-addressable by the driver, so
+	 * the frame is copied once into an skb. Allocating the skb from the
+	 * per-device page-fragment cache avoids the kmalloc size-class lookup
+	 * of 'alloc_skb' and yields cache-line aligned data, which satisfies
+	 * the FEC TX alignment without a copy to the driver's bounce buffer.
+	 */
+	struct sk_buff *skb = netdev_alloc_skb(ctx->dev, len);
 
 	if (!skb) {
-		printk("alloc_skb failed\n");
+		ctx->stats->tx_alloc_failed++;
 		return GENODE_UPLINK_RX_RETRY;
 	}
 
-	skb_copy_to_linear_data(skb, ptr, len);
-	skb_put(skb, len);
-	skb->dev = ctx->dev;
+	skb_put_data(skb, ptr, len);
+
+	if (nic_config.classify)
+		skb->priority = frame_priority((unsigned char const *)ptr, len);
+
+	if (nic_config.checksum_offload) {
+		skb_reset_mac_header(skb);
+		request_tx_checksum(skb);
+	}
+
+	if (nic_config.ptp && ptp_event_header((unsigned char const *)ptr, len))
+		skb_shinfo(skb)->tx_flags |= SKBTX_HW_TSTAMP;
 
 	if (dev_queue_xmit(skb) < 0) {
-		printk("lx_user: failed to xmit packet\n");
+		ctx->stats->tx_xmit_failed++;
 		return GENODE_UPLINK_RX_REJECTED;
 	}
 
+	ctx->stats->tx_packets++;
+	ctx->stats->tx_bytes += len;
+	sample_tx_rings(ctx->dev, ctx->stats);
+
 	return GENODE_UPLINK_RX_ACCEPTED;
 }
 
 
-static int user_task_function(void *arg)
+/*
+ * Transmit packets received from the uplink session
+ *
+ * The uplink is drained in batches of 'tx_batch' packets. Between two
+ * batches, the task yields so that NAPI RX polling and TX completion can
+ * run, which keeps the rings from overflowing while the uplink is busy.
+ * Acknowledgements are propagated to the uplink peer once per I/O-progress
+ * round by the Genode side.
+ */
+static void uplink_tx_drain(struct net_device *dev)
 {
-	for (;;) {
+	struct genode_uplink_rx_context ctx = { .dev   = dev,
+	                                        .stats = dev_stats(dev) };
+
+	unsigned const batch = nic_config.tx_batch ? nic_config.tx_batch
+	                                           : TX_BATCH_DEFAULT;
+	unsigned count = 0;
+
+	while (genode_uplink_rx(dev_genode_uplink(dev), uplink_rx_one_packet, &ctx)) {
+
+		if (++count < batch)
+			continue;
+
+		count = 0;
+		lx_emul_task_schedule(false);
+	}
+}
+
+
+/*
+ * Net devices with an uplink, served by the data path
+ *
+ * The set changes only along with the link state, which is handled by
+ * 'manage_devices'.
+ */
+static struct net_device *uplink_devs[MAX_NICS];
 
-		struct net_device *dev;
+/* link state or set of net devices changed, see 'rtmsg_ifinfo' */
+static bool link_pending = true;
 
-		for_each_netdev(&init_net, dev) {
-			rtnl_lock();
 
-			/* enable link sensing, repeated calls are handled by testing IFF_UP */
-			dev_open(dev, 0);
+static void manage_devices(bool config_changed, bool stats_requested)
+{
+	struct net_device *dev;
+	unsigned count = 0;
 
-			/* install rx handler once */
-			if (!netdev_is_rx_handler_busy(dev))
-				netdev_rx_handler_register(dev, handle_rx, NULL);
+	rtnl_lock();
 
-			/* respond to cable plug/unplug */
-			handle_create_uplink(dev);
-			handle_destroy_uplink(dev);
+	for_each_netdev(&init_net, dev) {
 
-			/* transmit packets received from the uplink session */
-			if (netif_carrier_ok(dev)) {
+		/* enable link sensing, repeated calls are handled by testing IFF_UP */
+		dev_open(dev, 0);
 
-				struct genode_uplink_rx_context ctx = { .dev = dev };
+		/* install rx handler once */
+		if (!netdev_is_rx_handler_busy(dev))
+			netdev_rx_handler_register(dev, handle_rx, NULL);
 
-				while (genode_uplink_rx(dev_genode_uplink(dev),
-				                        uplink_rx_one_packet,
-				                        &ctx));
-			}
-			rtnl_unlock();
-		};
+		/* respond to cable plug/unplug */
+		handle_create_uplink(dev);
+		handle_destroy_uplink(dev);
+
+		if (config_changed && dev_genode_uplink(dev))
+			apply_nic_config(dev);
+
+		if (stats_requested)
+			snapshot_stats(dev);
+
+		if (dev_genode_uplink(dev) && count < MAX_NICS)
+			uplink_devs[count++] = dev;
+	}
+
+	rtnl_unlock();
+
+	while (count < MAX_NICS)
+		uplink_devs[count++] = NULL;
+}
+
+
+static int user_task_function(void *arg)
+{
+	for (;;) {
+
+		bool const link_changed    = link_pending;
+		bool const config_changed  = nic_config_pending;
+		bool const stats_requested = nic_stats_pending;
+		unsigned i;
+
+		link_pending       = false;
+		nic_config_pending = false;
+		nic_stats_pending  = false;
+
+		/*
+		 * Most activations are caused by packets from the uplink and
+		 * take the data path only
+		 */
+		if (link_changed || config_changed || stats_requested)
+			manage_devices(config_changed, stats_requested);
+
+		/* transmit packets received from the uplink sessions */
+		for (i = 0; i < MAX_NICS && uplink_devs[i]; i++)
+			if (netif_carrier_ok(uplink_devs[i]))
+				uplink_tx_drain(uplink_devs[i]);
 
 		/* block until lx_emul_task_unblock */
 		lx_emul_task_schedule(true);
@@ -214,6 +860,32 @@ void lx_user_init(void)
 void rtmsg_ifinfo(int type, struct net_device * dev, unsigned int change, gfp_t flags)
 {
 	/* trigger handle_create_uplink / handle_destroy_uplink */
+	link_pending = true;
+
 	if (user_task_struct_ptr)
 		lx_emul_task_unblock(user_task_struct_ptr);
 }
+
+
+#include <linux/skbuff.h>
+
+void __real_skb_tstamp_tx(struct sk_buff *orig_skb,
+                          struct skb_shared_hwtstamps *hwtstamps);
+void __wrap_skb_tstamp_tx(struct sk_buff *orig_skb,
+                          struct skb_shared_hwtstamps *hwtstamps);
+
+/*
+ * Called by the driver with the hardware time stamp of a sent frame
+ *
+ * The call is redirected here via '--wrap' as there is no socket to
+ * deliver the time stamp to.
+ */
+void __wrap_skb_tstamp_tx(struct sk_buff *orig_skb,
+                          struct skb_shared_hwtstamps *hwtstamps)
+{
+	if (hwtstamps && orig_skb->dev)
+		ptp_record(orig_skb->dev, true, orig_skb->data,
+		           skb_headlen(orig_skb), hwtstamps->hwtstamp);
+
+	__real_skb_tstamp_tx(orig_skb, hwtstamps);
+}
@@ -0,0 +1,127 @@
+/*
+ * \brief  Interface between the Genode frontend and the Linux-side user task
+ * \author Stefan Kalkowski
+ * \date   2022-10-17
+ */
+
+/*
+ * Copyright (C) 2022 Genode Labs GmbH
+ *
+ * This file is distributed under the terms of the GNU General Public License
+ * version 2.
+ */
+
+#ifndef _LX_USER_H_
+#define _LX_USER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tunables of the NIC driver, a value of zero keeps the driver default
+ */
+struct lx_user_nic_config
+{
+	unsigned rx_coalesce_usecs;
+	unsigned rx_coalesce_frames;
+	unsigned tx_coalesce_usecs;
+	unsigned tx_coalesce_frames;
+	unsigned napi_weight;
+	unsigned tx_batch;
+	bool     classify;  /* steer TX frames by VLAN PCP or DSCP onto queues */
+
+	/* IPv4/TCP/UDP checksums computed and verified by the controller */
+	bool     checksum_offload;
+
+	/* IEEE 1588 hardware time stamping and clock adjustment */
+	bool      ptp;
+	int       ptp_freq_ppb;  /* frequency offset of the hardware clock */
+	long long ptp_step_ns;   /* clock step, applied once per 'ptp_adjust' */
+	unsigned  ptp_adjust;    /* sequence number of the clock step */
+};
+
+/**
+ * Apply a new configuration, effective at the next user-task activation
+ */
+void lx_user_configure(struct lx_user_nic_config const *config);
+
+
+enum { LX_USER_NIC_STAT_NAME_LEN = 32 };
+
+/*
+ * Statistics of one network device
+ *
+ * 'rx' denotes frames received from the wire and passed to the uplink,
+ * 'tx' frames taken from the uplink and handed to the controller.
+ */
+struct lx_user_nic_stats
+{
+	char const *name;
+	bool        link;
+
+	unsigned long long rx_packets;
+	unsigned long long rx_bytes;
+	unsigned long long rx_uplink_full;   /* dropped, uplink out of packets */
+	unsigned long long rx_oversized;     /* dropped, exceeds uplink packet */
+
+	unsigned long long tx_packets;
+	unsigned long long tx_bytes;
+	unsigned long long tx_alloc_failed;  /* deferred, no skb available */
+	unsigned long long tx_xmit_failed;   /* dropped by the driver */
+
+	unsigned tx_ring_size;      /* descriptors of all TX rings */
+	unsigned tx_ring_used;      /* descriptors in flight at snapshot time */
+	unsigned tx_ring_used_max;  /* high-water mark since last snapshot */
+
+	/* hardware MIB counters, names are LX_USER_NIC_STAT_NAME_LEN apart */
+	unsigned                  mib_count;
+	char               const *mib_names;
+	unsigned long long const *mib_values;
+};
+
+/**
+ * Request a statistics snapshot, taken at the next user-task activation
+ */
+void lx_user_stats_request(void);
+
+/**
+ * Call 'fn' with the most recent snapshot of each network device
+ */
+void lx_user_for_each_nic_stats(void (*fn)(struct lx_user_nic_stats const *, void *),
+                                void *data);
+
+
+/*
+ * Hardware time stamp of a PTP event message
+ *
+ * The uplink cannot attach metadata to packets. Hence, time stamps are
+ * matched to frames by the PTP message type and sequence ID instead.
+ */
+struct lx_user_ptp_timestamp
+{
+	char const        *nic;
+	bool               tx;
+	unsigned char      type;      /* PTP messageType */
+	unsigned char      domain;    /* PTP domainNumber */
+	unsigned short     sequence;  /* PTP sequenceId */
+	unsigned long long ns;        /* time of the hardware clock */
+};
+
+/**
+ * Return true if time stamps were recorded since the last call of
+ * 'lx_user_for_each_ptp_timestamp'
+ */
+bool lx_user_ptp_pending(void);
+
+/**
+ * Call 'fn' for each recorded time stamp and discard the records
+ */
+void lx_user_for_each_ptp_timestamp(void (*fn)(struct lx_user_ptp_timestamp const *, void *),
+                                    void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LX_USER_H_ */
@@ -13,12 +13,17 @@
 
 #include <base/attached_rom_dataspace.h>
 #include <base/component.h>
+#include <os/reporter.h>
+#include <timer_session/connection.h>
+#include <util/reconstructible.h>
 #include <lx_emul/init.h>
 #include <lx_emul/task.h>
 #include <lx_kit/env.h>
 #include <lx_kit/init.h>
 #include <genode_c_api/uplink.h>
 
+#include <lx_user.h>
+
 using namespace Genode;
 struct Main;
 
@@ -29,6 +34,7 @@ struct Main : private Entrypoint::Io_progress_handler
 {
 	Env                  & _env;
 	Attached_rom_dataspace _dtb_rom { _env, "nic_drv.dtb" };
+	Attached_rom_dataspace _config  { _env, "config" };
 
 	/**
 	 * Entrypoint::Io_progress_handler
@@ -36,6 +42,10 @@ struct Main : private Entrypoint::Io_progress_handler
 	void handle_io_progress() override
 	{
 		genode_uplink_notify_peers();
+
+		if (_ptp_reporter.constructed() && lx_user_ptp_pending())
+			_ptp_reporter->generate([&] (Xml_generator &xml) {
+				lx_user_for_each_ptp_timestamp(_generate_ptp_timestamp, &xml); });
 	}
 
 	/**
@@ -69,6 +79,167 @@ struct Main : private Entrypoint::Io_progress_handler
 	}
 
 
+	/*
+	 * Statistics report, rate-limited to one report per 'interval_ms'
+	 */
+	Constructible<Timer::Connection>  _report_timer { };
+	Constructible<Expanding_reporter> _reporter     { };
+
+	/*
+	 * Hardware time stamps of PTP event messages, reported once per
+	 * I/O-progress round
+	 */
+	Constructible<Expanding_reporter> _ptp_reporter { };
+
+	static void _generate_ptp_timestamp(lx_user_ptp_timestamp const *ts, void *data)
+	{
+		Xml_generator &xml = *static_cast<Xml_generator *>(data);
+
+		xml.node(ts->tx ? "tx" : "rx", [&] () {
+			xml.attribute("nic",      ts->nic);
+			xml.attribute("type",     ts->type);
+			xml.attribute("domain",   ts->domain);
+			xml.attribute("sequence", ts->sequence);
+			xml.attribute("ns",       ts->ns);
+		});
+	}
+
+	static void _generate_nic_stats(lx_user_nic_stats const *stats, void *data)
+	{
+		Xml_generator &xml = *static_cast<Xml_generator *>(data);
+
+		xml.node("nic", [&] () {
+			xml.attribute("name", stats->name ? stats->name : "");
+			xml.attribute("link", stats->link);
+
+			xml.node("rx", [&] () {
+				xml.attribute("packets",     stats->rx_packets);
+				xml.attribute("bytes",       stats->rx_bytes);
+				xml.attribute("uplink_full", stats->rx_uplink_full);
+				xml.attribute("oversized",   stats->rx_oversized);
+			});
+
+			xml.node("tx", [&] () {
+				xml.attribute("packets",       stats->tx_packets);
+				xml.attribute("bytes",         stats->tx_bytes);
+				xml.attribute("alloc_failed",  stats->tx_alloc_failed);
+				xml.attribute("xmit_failed",   stats->tx_xmit_failed);
+				xml.attribute("ring_size",     stats->tx_ring_size);
+				xml.attribute("ring_used",     stats->tx_ring_used);
+				xml.attribute("ring_used_max", stats->tx_ring_used_max);
+			});
+
+			if (!stats->mib_count)
+				return;
+
+			xml.node("mib", [&] () {
+				for (unsigned i = 0; i < stats->mib_count; i++) {
+					using Name = String<LX_USER_NIC_STAT_NAME_LEN + 1>;
+					Name const name(Cstring(stats->mib_names + i*LX_USER_NIC_STAT_NAME_LEN,
+					                        LX_USER_NIC_STAT_NAME_LEN));
+					xml.attribute(name.string(), stats->mib_values[i]);
+				}
+			});
+		});
+	}
+
+	Signal_handler<Main> _report_handler { _env.ep(), *this, &Main::_handle_report };
+
+	void _handle_report()
+	{
+		if (!_reporter.constructed() || !user_task_struct_ptr)
+			return;
+
+		/* let the user task take a snapshot */
+		lx_user_stats_request();
+		lx_emul_task_unblock(user_task_struct_ptr);
+		Lx_kit::env().scheduler.schedule();
+
+		_reporter->generate([&] (Xml_generator &xml) {
+			lx_user_for_each_nic_stats(_generate_nic_stats, &xml); });
+	}
+
+	void _configure_report(Xml_node const &config)
+	{
+		if (!config.has_sub_node("report")) {
+			_reporter.destruct();
+			_report_timer.destruct();
+			return;
+		}
+
+		unsigned const interval_ms =
+			max(100U, config.sub_node("report").attribute_value("interval_ms", 1000U));
+
+		if (!_reporter.constructed())
+			_reporter.construct(_env, "nic_stats", "nic_stats");
+
+		if (!_report_timer.constructed()) {
+			_report_timer.construct(_env);
+			_report_timer->sigh(_report_handler);
+		}
+
+		_report_timer->trigger_periodic(1000*interval_ms);
+	}
+
+	/*
+	 * The clock step may exceed the range of 'long', which has 32 bits on
+	 * arm_v7, so it is parsed as 'long long'
+	 */
+	static long long _ptp_step_ns(Xml_node const &config)
+	{
+		using Value = String<24>;
+
+		Value const value = config.attribute_value("ptp_step_ns", Value());
+
+		long long step_ns = 0;
+		if (value.valid() && ascii_to_signed(value.string(), step_ns) != value.length() - 1) {
+			warning("invalid ptp_step_ns \"", value, "\"");
+			return 0;
+		}
+		return step_ns;
+	}
+
+	Signal_handler<Main> _config_handler { _env.ep(), *this, &Main::_handle_config };
+
+	void _handle_config()
+	{
+		_config.update();
+
+		Xml_node const config = _config.xml();
+
+		lx_user_nic_config const nic_config {
+			.rx_coalesce_usecs  = config.attribute_value("rx_coalesce_usecs",  0U),
+			.rx_coalesce_frames = config.attribute_value("rx_coalesce_frames", 0U),
+			.tx_coalesce_usecs  = config.attribute_value("tx_coalesce_usecs",  0U),
+			.tx_coalesce_frames = config.attribute_value("tx_coalesce_frames", 0U),
+			.napi_weight        = config.attribute_value("napi_weight",        0U),
+			.tx_batch           = config.attribute_value("tx_batch",           0U),
+			.classify           = config.attribute_value("classify",        false),
+			.checksum_offload   = config.attribute_value("checksum_offload", false),
+			.ptp                = config.attribute_value("ptp",                false),
+			.ptp_freq_ppb       = config.attribute_value("ptp_freq_ppb",       0),
+			.ptp_step_ns        = _ptp_step_ns(config),
+			.ptp_adjust         = config.attribute_value("ptp_adjust",         0U),
+		};
+
+		lx_user_configure(&nic_config);
+
+		_configure_report(config);
+
+		bool const ptp = config.attribute_value("ptp", false);
+
+		if (ptp && !_ptp_reporter.constructed())
+			_ptp_reporter.construct(_env, "ptp", "ptp");
+
+		if (!ptp)
+			_ptp_reporter.destruct();
+
+		if (user_task_struct_ptr) {
+			lx_emul_task_unblock(user_task_struct_ptr);
+			Lx_kit::env().scheduler.schedule();
+		}
+	}
+
 	Main(Env & env) : _env(env)
 	{
 		log("--- i.MX FEC nic driver started ---");
@@ -80,6 +251,9 @@ struct Main : private Entrypoint::Io_progress_handler
 		                   genode_allocator_ptr(Lx_kit::env().heap),
 		                   genode_signal_handler_ptr(_signal_handler));
 
+		_config.sigh(_config_handler);
+		_handle_config();
+
 		lx_emul_start_kernel(_dtb_rom.local_addr<void>());
 
 		env.ep().register_io_progress_handler(*this);
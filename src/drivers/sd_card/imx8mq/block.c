@@ -12,16 +12,28 @@
  */
 
 #include <../block/blk.h>
+#include <../drivers/mmc/core/queue.h>
+#include <../drivers/mmc/host/sdhci.h>
 #include <linux/module.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
+#include <linux/crc32.h>
+#include <linux/ctype.h>
+#include <linux/interrupt.h>
+#include <linux/irqdesc.h>
+#include <linux/ktime.h>
+#include <linux/part_stat.h>
+#include <asm/unaligned.h>
 #include <uapi/linux/hdreg.h>
 
 #include <genode_c_api/block.h>
+#include <lx_emul/alloc.h>
 #include <lx_emul/debug.h>
 #include <lx_user/init.h>
 #include <lx_user/io.h>
 
+#include <lx_user.h>
+
 
 static int __init genhd_device_init(void)
 {
@@ -30,14 +42,31 @@ static int __init genhd_device_init(void)
 subsys_initcall(genhd_device_init);
 
 
+/*
+ * Block devices of the block layer, looked up by their device number
+ *
+ * All MMC disks share one major number, hence the full device number is
+ * used as key.
+ */
+struct bdev_entry
+{
+	struct list_head    list;
+	struct block_device bdev;
+};
+
+static LIST_HEAD(bdev_entries);
+
+
 struct block_device *bdev_alloc(struct gendisk *disk, u8 partno)
 {
-	struct block_device * bdev  = kzalloc(sizeof(struct block_device), GFP_KERNEL);
+	struct bdev_entry   * entry = kzalloc(sizeof(struct bdev_entry), GFP_KERNEL);
+	struct block_device * bdev  = &entry->bdev;
 	struct inode        * inode = kzalloc(sizeof(struct inode), GFP_KERNEL);
 
 	inode->i_mode = S_IFBLK;
 	inode->i_rdev = 0;
 
+	INIT_LIST_HEAD(&entry->list);
 	mutex_init(&bdev->bd_mutex);
 	mutex_init(&bdev->bd_fsfreeze_mutex);
 	spin_lock_init(&bdev->bd_size_lock);
@@ -50,160 +79,1271 @@ struct block_device *bdev_alloc(struct gendisk *disk, u8 partno)
 }
 
 
-enum { MAX_BDEV = 256 };
-static struct block_device * bdevs[MAX_BDEV];
-
 void bdev_add(struct block_device * bdev, dev_t dev)
 {
-	unsigned idx = MAJOR(dev);
-	bdev->bd_dev = dev;
-	if (idx < MAX_BDEV) {
-		bdevs[idx] = bdev;
-		return;
-	}
+	struct bdev_entry * const entry = container_of(bdev, struct bdev_entry, bdev);
 
-	printk("Error: bdev_add invalid major=%u minor=%u\n",
-	       MAJOR(dev), MINOR(dev));
-	lx_emul_trace_and_stop(__func__);
+	bdev->bd_dev = dev;
+	list_add(&entry->list, &bdev_entries);
 }
 
 
 struct block_device * blkdev_get_by_dev(dev_t dev,fmode_t mode,void * holder)
 {
-	unsigned idx = MAJOR(dev);
-	if (idx < MAX_BDEV)
-		return bdevs[idx];
+	struct bdev_entry * entry;
+	list_for_each_entry(entry, &bdev_entries, list)
+		if (entry->bdev.bd_dev == dev)
+			return &entry->bdev;
 
 	printk("Error: blkdev_get_by_dev invalid major=%u minor=%u\n",
 	       MAJOR(dev), MINOR(dev));
 	return NULL;
 }
 
-enum { MAX_GEN_DISKS = 4 };
 
-struct gendisk * gendisks[MAX_GEN_DISKS];
+/*
+ * Called on the release of the gendisk owning the block device
+ */
+void bdput(struct block_device * bdev)
+{
+	struct bdev_entry * const entry = container_of(bdev, struct bdev_entry, bdev);
+
+	list_del(&entry->list);
+	free_percpu(bdev->bd_stats);
+	kfree(bdev->bd_inode);
+	kfree(entry);
+}
+
+
+/*
+ * Block devices announced to Genode
+ *
+ * Each gendisk is announced as a whole, e.g., as "mmcblk1". Once its
+ * partition table is read, each partition is announced as device of its
+ * own, e.g., as "mmcblk1p2", which refers to a sector range of the gendisk.
+ * So a client using one partition only is served directly by the driver.
+ */
+struct block_disk;
+
+struct block_dev
+{
+	struct list_head    list;   /* element of 'block_disk::devs' */
+	struct block_disk * bdisk;
+	struct gendisk    * disk;
+	char                name[DISK_NAME_LEN + 8];
+	sector_t            start;
+	sector_t            count;
+	bool                writeable;
+
+	/*
+	 * Session of the device, looked up by the block task only if a client
+	 * signalled new requests or completed requests are to be acknowledged
+	 */
+	struct genode_block_session * session;
+
+	struct list_head completed;  /* requests to be acknowledged */
+
+	/* requests up to this size are completed by polling, 0 disables */
+	unsigned long    poll_max_size;
+	unsigned         polled_in_flight;
+
+	struct lx_user_block_stats stats;
+
+	/* totals at the previous statistics query, for computing rates */
+	ktime_t            stats_time;
+	unsigned long long stats_requests[LX_USER_BLOCK_OPS];
+	unsigned long long stats_bytes[LX_USER_BLOCK_OPS];
+};
+
+
+/*
+ * Client request completed by the block layer or waiting for a flush
+ *
+ * Completed requests are acknowledged by the block task after looking up
+ * the session, which the client may have closed meanwhile.
+ */
+struct block_completion
+{
+	struct list_head              list;
+	struct block_dev            * dev;
+	struct genode_block_request * request;
+	ktime_t                       start;
+	bool                          success;
+	struct bio                  * bio;  /* put once acknowledged, or NULL */
+};
+
+
+/*
+ * State of a gendisk shared by all its block devices
+ *
+ * Sync requests of all devices of a disk are coalesced into one cache
+ * flush. A flush covers only writes completed before, hence syncs are
+ * collected in 'pending' until all writes submitted before the latest
+ * pending sync are completed, and until the flush in flight, if any, is
+ * finished.
+ *
+ * Writes are numbered in the order of their submission. The writes in
+ * flight numbered up to 'barrier' are counted by 'barrier_writes'.
+ *
+ * The disk holds a reference to the gendisk. A removed disk and its
+ * devices are freed by the block task once no request refers to them
+ * anymore.
+ */
+struct block_disk
+{
+	struct list_head list;       /* element of 'block_disks' */
+	struct list_head devs;
+	struct gendisk * disk;
+	bool             removed;
+	bool             unscanned;  /* partition table not read yet */
+	bool             dirty;      /* writes completed since the last flush */
+	bool             flushing;   /* flush bio in flight */
+
+	u64      write_seq;          /* number of the last submitted write */
+	u64      barrier;            /* last write preceding a pending sync */
+	unsigned writes_in_flight;
+	unsigned barrier_writes;
+
+	struct list_head pending;    /* syncs waiting for the next flush */
+	struct list_head flushing_syncs;
+};
+
+
+static LIST_HEAD(block_disks);
+
+/* set if a client signalled new requests since the last block-task run */
+static bool block_sessions_signalled;
+
+static struct task_struct * lx_user_task = NULL;
+
+
+static void block_wakeup(void)
+{
+	if (lx_user_task)
+		lx_emul_task_unblock(lx_user_task);
+}
+
+
+static struct block_disk * block_disk_by_gendisk(struct gendisk * const disk)
+{
+	struct block_disk * bdisk;
+	list_for_each_entry(bdisk, &block_disks, list)
+		if (bdisk->disk == disk && !bdisk->removed)
+			return bdisk;
+
+	return NULL;
+}
+
+
+static void block_stats_complete(struct lx_user_block_stats        * const stats,
+                                 struct genode_block_request const * const request,
+                                 ktime_t                             const start,
+                                 bool                                const success)
+{
+	struct lx_user_block_op_stats * op;
+	u64 const us = ktime_us_delta(ktime_get(), start);
+
+	if (stats->in_flight)
+		stats->in_flight--;
+
+	switch (request->op) {
+	case GENODE_BLOCK_READ:  op = &stats->ops[LX_USER_BLOCK_READ];  break;
+	case GENODE_BLOCK_WRITE: op = &stats->ops[LX_USER_BLOCK_WRITE]; break;
+	case GENODE_BLOCK_SYNC:  op = &stats->ops[LX_USER_BLOCK_SYNC];  break;
+	case GENODE_BLOCK_TRIM:  op = &stats->ops[LX_USER_BLOCK_TRIM];  break;
+	default: return;
+	}
+
+	op->requests++;
+
+	if (!success) {
+		op->errors++;
+		return;
+	}
+
+	if (request->op != GENODE_BLOCK_SYNC)
+		op->bytes += (u64)request->blk_cnt << SECTOR_SHIFT;
+
+	op->latency[min_t(unsigned, fls64(us), LX_USER_BLOCK_LATENCY_BUCKETS - 1)]++;
+	op->latency_max_us = max_t(u64, op->latency_max_us, us);
+}
+
+
+/*
+ * Acknowledge a client request right away and account it in the device
+ * statistics
+ *
+ * Only called by the block task while handling the looked-up session.
+ */
+static void block_ack(struct block_dev            * const dev,
+                      struct genode_block_request * const request,
+                      ktime_t                       const start,
+                      bool                          const success)
+{
+	block_stats_complete(&dev->stats, request, start, success);
+
+	if (dev->session)
+		genode_block_ack_request(dev->session, request, success);
+}
+
+
+/*
+ * Account a completed request and queue it for the acknowledgement
+ */
+static void block_complete(struct block_completion * const done,
+                           bool                      const success)
+{
+	block_stats_complete(&done->dev->stats, done->request, done->start, success);
+
+	done->success = success;
+	list_add_tail(&done->list, &done->dev->completed);
+}
+
+
+static void block_complete_syncs(struct list_head * const syncs,
+                                 bool               const success)
+{
+	struct block_completion * sync, * next;
+
+	list_for_each_entry_safe(sync, next, syncs, list) {
+		list_del(&sync->list);
+		block_complete(sync, success);
+	}
+}
+
+
+/*
+ * Acknowledge the completed requests of 'dev' to its looked-up session
+ */
+static void block_ack_completed(struct block_dev * const dev)
+{
+	struct block_completion * done, * next;
+
+	list_for_each_entry_safe(done, next, &dev->completed, list) {
+
+		if (dev->session)
+			genode_block_ack_request(dev->session, done->request,
+			                         done->success);
+
+		list_del(&done->list);
+
+		if (done->bio)
+			bio_put(done->bio);
+		else
+			kfree(done);
+	}
+}
+
+
+enum { MAX_POLL_POLICIES = 16 };
+
+static struct block_poll_policy
+{
+	char          device[DISK_NAME_LEN + 8];
+	unsigned long max_size;
+} block_poll_policies[MAX_POLL_POLICIES];
+
+static unsigned block_poll_policy_count;
+static unsigned block_poll_budget_us;
+
+
+static unsigned long block_poll_max_size(char const * const name)
+{
+	unsigned i;
+	for (i = 0; i < block_poll_policy_count; i++)
+		if (!strcmp(block_poll_policies[i].device, name))
+			return block_poll_policies[i].max_size;
+
+	return 0;
+}
+
+
+void lx_user_block_configure_poll(struct lx_user_block_poll_policy const *policies,
+                                  unsigned count, unsigned budget_us)
+{
+	struct block_disk * bdisk;
+	struct block_dev  * dev;
+	unsigned i;
+
+	block_poll_policy_count = min_t(unsigned, count, MAX_POLL_POLICIES);
+	block_poll_budget_us    = budget_us;
+
+	for (i = 0; i < block_poll_policy_count; i++) {
+		strscpy(block_poll_policies[i].device, policies[i].device,
+		        sizeof(block_poll_policies[i].device));
+		block_poll_policies[i].max_size = policies[i].max_size;
+	}
+
+	list_for_each_entry(bdisk, &block_disks, list)
+		list_for_each_entry(dev, &bdisk->devs, list)
+			dev->poll_max_size = block_poll_max_size(dev->name);
+}
+
+
+static struct block_dev * block_dev_add(struct block_disk * const bdisk,
+                                        char        const * const name,
+                                        sector_t            const start,
+                                        sector_t            const count)
+{
+	struct gendisk   * const disk = bdisk->disk;
+	struct block_dev * const dev  = kzalloc(sizeof(*dev), GFP_KERNEL);
+
+	if (!dev) {
+		printk("Error: could not allocate block device %s\n", name);
+		return NULL;
+	}
+
+	dev->bdisk     = bdisk;
+	dev->disk      = disk;
+	dev->start     = start;
+	dev->count     = count;
+	dev->writeable = !get_disk_ro(disk);
+	strscpy(dev->name, name, sizeof(dev->name));
+
+	dev->poll_max_size = block_poll_max_size(dev->name);
+
+	INIT_LIST_HEAD(&dev->completed);
+
+	dev->stats.name = dev->name;
+	dev->stats.disk = disk->disk_name;
+	dev->stats_time = ktime_get();
+
+	list_add_tail(&dev->list, &bdisk->devs);
+
+	genode_block_announce_device(dev->name, dev->count,
+	                             dev->writeable ? 1 : 0);
+
+	return dev;
+}
+
 
 int blk_register_queue(struct gendisk * disk)
 {
-	unsigned idx;
-	for (idx = 0; idx < MAX_GEN_DISKS; idx++)
-		if (!gendisks[idx])
-			break;
+	struct block_disk * const bdisk = kzalloc(sizeof(*bdisk), GFP_KERNEL);
 
-	if (idx >= MAX_GEN_DISKS)
-		return -1;
+	if (!bdisk)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&bdisk->devs);
+	INIT_LIST_HEAD(&bdisk->pending);
+	INIT_LIST_HEAD(&bdisk->flushing_syncs);
+	bdisk->disk      = disk;
+	bdisk->unscanned = true;
+
+	if (!block_dev_add(bdisk, disk->disk_name, 0, get_capacity(disk))) {
+		kfree(bdisk);
+		return -ENOMEM;
+	}
 
-	genode_block_announce_device(disk->disk_name, get_capacity(disk),
-	                             get_disk_ro(disk) ? 0 : 1);
-	gendisks[idx] = disk;
+	get_device(disk_to_dev(disk));
+	list_add_tail(&bdisk->list, &block_disks);
+
+	/* let the block task read the partition table */
+	block_wakeup();
 	return 0;
 }
 
 
 void blk_unregister_queue(struct gendisk * disk)
 {
-	unsigned idx;
-	for (idx = 0; idx < MAX_GEN_DISKS; idx++)
-		if (gendisks[idx] == disk)
-			gendisks[idx] = NULL;
+	struct block_disk * const bdisk = block_disk_by_gendisk(disk);
+	struct block_dev  * dev;
+
+	if (!bdisk)
+		return;
+
+	block_complete_syncs(&bdisk->pending, false);
+
+	bdisk->removed   = true;
+	bdisk->unscanned = false;
+	bdisk->dirty     = false;
+
+	list_for_each_entry(dev, &bdisk->devs, list)
+		genode_block_discontinue_device(dev->name);
+
+	/* let the block task free the disk */
+	block_wakeup();
+}
+
+
+/*
+ * Free removed devices and disks no longer referred to by any request
+ */
+static void block_reap(void)
+{
+	struct block_disk * bdisk, * next_bdisk;
+	struct block_dev  * dev,   * next_dev;
+
+	list_for_each_entry_safe(bdisk, next_bdisk, &block_disks, list) {
+
+		if (!bdisk->removed)
+			continue;
+
+		list_for_each_entry_safe(dev, next_dev, &bdisk->devs, list) {
+
+			if (!list_empty(&dev->completed)) {
+				dev->session = genode_block_session_by_name(dev->name);
+				block_ack_completed(dev);
+			}
+
+			if (!dev->stats.in_flight) {
+				list_del(&dev->list);
+				kfree(dev);
+			}
+		}
+
+		if (!list_empty(&bdisk->devs) || bdisk->flushing)
+			continue;
+
+		list_del(&bdisk->list);
+		put_device(disk_to_dev(bdisk->disk));
+		kfree(bdisk);
+	}
+}
+
+
+/*
+ * Synchronously read 'len' bytes at 'sector' into the page-aligned 'buf'
+ */
+static int block_read(struct gendisk * const disk, sector_t const sector,
+                      void * const buf, unsigned const len)
+{
+	struct bio * const bio = bio_alloc(GFP_KERNEL, 1);
+	int err;
+
+	bio_set_dev(bio, disk->part0);
+
+	bio->bi_iter.bi_sector = sector;
+	bio->bi_opf            = REQ_OP_READ;
+
+	bio_add_page(bio, virt_to_page(buf), len, 0);
+
+	err = submit_bio_wait(bio);
+	bio_put(bio);
+	return err;
+}
+
+
+static void block_add_partition(struct gendisk * const disk,
+                                unsigned         const number,
+                                sector_t         const start,
+                                sector_t         const count)
+{
+	char const * const disk_name = disk->disk_name;
+	size_t       const len       = strlen(disk_name);
+
+	struct block_disk * const bdisk = block_disk_by_gendisk(disk);
+
+	char name[sizeof(((struct block_dev *)0)->name)];
+
+	/* the disk got removed while reading the partition table */
+	if (!bdisk)
+		return;
+
+	if (!count || start + count < start || start + count > get_capacity(disk)) {
+		printk("%s: ignoring partition %u exceeding the disk\n",
+		       disk_name, number);
+		return;
+	}
+
+	/* follow the Linux naming scheme, e.g., "mmcblk1p2" */
+	snprintf(name, sizeof(name), "%s%s%u", disk_name,
+	         len && isdigit(disk_name[len - 1]) ? "p" : "", number);
+
+	block_dev_add(bdisk, name, start, count);
+}
+
+
+enum {
+	MBR_ENTRIES   = 446,
+	MBR_SIGNATURE = 510,
+	MBR_TYPE_GPT  = 0xee,
+
+	/* bound of the EBR chain, which may be corrupt or cyclic */
+	MAX_LOGICAL_PARTITIONS = 64,
+};
+
+
+static bool mbr_signature(u8 const * const mbr)
+{
+	return get_unaligned_le16(mbr + MBR_SIGNATURE) == 0xaa55;
+}
+
+
+/*
+ * Check whether the first sector holds a partition table
+ *
+ * Like Linux, a boot indicator other than 0x00 or 0x80 in any of the four
+ * entries marks a boot sector without partition table, e.g., the volume
+ * boot record of a FAT-formatted card without partitions.
+ */
+static bool mbr_valid(u8 const * const mbr)
+{
+	unsigned i;
+
+	if (!mbr_signature(mbr))
+		return false;
+
+	for (i = 0; i < 4; i++) {
+		u8 const boot_ind = mbr[MBR_ENTRIES + 16*i];
+
+		if (boot_ind != 0x00 && boot_ind != 0x80)
+			return false;
+	}
+	return true;
+}
+
+
+static bool extents_overlap(u64 const start_a, u64 const count_a,
+                            u64 const start_b, u64 const count_b)
+{
+	return start_a < start_b + count_b && start_b < start_a + count_a;
+}
 
-	genode_block_discontinue_device(disk->disk_name);
+
+static bool mbr_extended(u8 const type)
+{
+	return type == 0x05 || type == 0x0f || type == 0x85;
 }
 
 
+/*
+ * Add the logical partitions of the extended partition at 'ext_start'
+ *
+ * Each extended boot record (EBR) holds one logical partition relative to
+ * the EBR and a link to the next EBR relative to the extended partition.
+ * Logical partitions and links outside of the extended partition are
+ * ignored.
+ */
+static void block_scan_ebr(struct gendisk * const disk,
+                           sector_t         const ext_start,
+                           sector_t         const ext_count,
+                           u8             * const buf)
+{
+	sector_t const ext_end = ext_start + ext_count;
 
+	sector_t ebr = ext_start;
+	unsigned number;
+
+	for (number = 5; number < 5 + MAX_LOGICAL_PARTITIONS; number++) {
+
+		u8 const * const entry = buf + MBR_ENTRIES;
+		u8 const * const link  = entry + 16;
+
+		sector_t start, count;
+
+		if (block_read(disk, ebr, buf, SECTOR_SIZE) || !mbr_signature(buf))
+			return;
+
+		start = ebr + get_unaligned_le32(entry + 8);
+		count = get_unaligned_le32(entry + 12);
+
+		if (entry[4] && count) {
+			if (start > ebr && start < ext_end && count <= ext_end - start)
+				block_add_partition(disk, number, start, count);
+			else
+				printk("%s: ignoring logical partition %u outside of "
+				       "the extended partition\n", disk->disk_name, number);
+		}
+
+		if (!mbr_extended(link[4]) || !get_unaligned_le32(link + 8)
+		 || get_unaligned_le32(link + 8) >= ext_count)
+			return;
+
+		ebr = ext_start + get_unaligned_le32(link + 8);
+	}
+}
+
+
+/*
+ * Add the partitions of the master boot record
+ *
+ * Entries exceeding the disk are ignored. Primary partitions overlapping
+ * each other render the whole table invalid.
+ */
+static void block_scan_mbr(struct gendisk * const disk, u8 * const buf)
+{
+	sector_t const capacity = get_capacity(disk);
+
+	struct { u8 type; u32 start, count; } entries[4];
+	unsigned i, j;
+
+	for (i = 0; i < 4; i++) {
+		u8 const * const entry = buf + MBR_ENTRIES + 16*i;
+
+		entries[i].type  = entry[4];
+		entries[i].start = get_unaligned_le32(entry + 8);
+		entries[i].count = get_unaligned_le32(entry + 12);
+
+		if (!entries[i].type || !entries[i].count)
+			continue;
+
+		if (!entries[i].start || entries[i].start >= capacity
+		 || entries[i].count > capacity - entries[i].start) {
+			printk("%s: ignoring partition %u exceeding the disk\n",
+			       disk->disk_name, i + 1);
+			entries[i].type = 0;
+		}
+	}
+
+	for (i = 0; i < 4; i++)
+		for (j = i + 1; j < 4; j++)
+			if (entries[i].type && entries[i].count
+			 && entries[j].type && entries[j].count
+			 && extents_overlap(entries[i].start, entries[i].count,
+			                    entries[j].start, entries[j].count)) {
+				printk("%s: overlapping partitions %u and %u, ignoring "
+				       "partition table\n", disk->disk_name, i + 1, j + 1);
+				return;
+			}
+
+	/* 'buf' is reused for reading the extended boot records */
+	for (i = 0; i < 4; i++) {
+
+		if (!entries[i].type || !entries[i].count)
+			continue;
+
+		if (mbr_extended(entries[i].type))
+			block_scan_ebr(disk, entries[i].start, entries[i].count, buf);
+		else
+			block_add_partition(disk, i + 1, entries[i].start,
+			                    entries[i].count);
+	}
+}
+
+
+enum {
+	GPT_HEADER_SIZE    = 12,
+	GPT_HEADER_CRC     = 16,
+	GPT_MY_LBA         = 24,
+	GPT_FIRST_USABLE   = 40,
+	GPT_LAST_USABLE    = 48,
+	GPT_ENTRIES_LBA    = 72,
+	GPT_ENTRIES        = 80,
+	GPT_ENTRY_SIZE     = 84,
+	GPT_ENTRIES_CRC    = 88,
+	GPT_MAX_ENTRIES    = 128,
+	GPT_ENTRY_FIRST    = 32,
+	GPT_ENTRY_LAST     = 40,
+};
+
+
+static u32 gpt_crc32(void const * const buf, size_t const len)
+{
+	return crc32_le(~0, buf, len) ^ ~0;
+}
+
+
+struct gpt_table
+{
+	u64 first;        /* first usable LBA */
+	u64 last;         /* last usable LBA */
+	u32 count;        /* number of entries */
+	u32 entry_size;
+	u8 * entries;
+};
+
+
+/*
+ * Read the GPT header at 'lba' and its entry array into 'table'
+ *
+ * As in Linux, the header is accepted only if it refers to 'lba', its
+ * usable range lies within the disk, and the checksums of the header and
+ * of the entry array match.
+ */
+static bool gpt_read(struct gendisk   * const disk,
+                     u64                const lba,
+                     u8               * const buf,
+                     struct gpt_table * const table)
+{
+	u64 const capacity = get_capacity(disk);
+
+	u64 entries_lba;
+	u32 header_size, header_crc, entries_crc, bytes;
+	unsigned off;
+
+	if (block_read(disk, lba, buf, SECTOR_SIZE) || memcmp(buf, "EFI PART", 8))
+		return false;
+
+	header_size       = get_unaligned_le32(buf + GPT_HEADER_SIZE);
+	header_crc        = get_unaligned_le32(buf + GPT_HEADER_CRC);
+	table->first      = get_unaligned_le64(buf + GPT_FIRST_USABLE);
+	table->last       = get_unaligned_le64(buf + GPT_LAST_USABLE);
+	entries_lba       = get_unaligned_le64(buf + GPT_ENTRIES_LBA);
+	table->count      = get_unaligned_le32(buf + GPT_ENTRIES);
+	table->entry_size = get_unaligned_le32(buf + GPT_ENTRY_SIZE);
+	entries_crc       = get_unaligned_le32(buf + GPT_ENTRIES_CRC);
+
+	put_unaligned_le32(0, buf + GPT_HEADER_CRC);
+
+	if (header_size < 92 || header_size > SECTOR_SIZE
+	 || gpt_crc32(buf, header_size) != header_crc
+	 || get_unaligned_le64(buf + GPT_MY_LBA) != lba
+	 || table->first > table->last || table->last >= capacity
+	 || table->entry_size < 128 || table->entry_size & (table->entry_size - 1)
+	 || !table->count
+	 || (u64)table->count * table->entry_size > GPT_MAX_ENTRIES * 128)
+		return false;
+
+	bytes = table->count * table->entry_size;
+
+	if (entries_lba >= capacity
+	 || DIV_ROUND_UP(bytes, SECTOR_SIZE) > capacity - entries_lba)
+		return false;
+
+	for (off = 0; off < bytes; off += PAGE_SIZE)
+		if (block_read(disk, entries_lba + (off >> SECTOR_SHIFT),
+		               table->entries + off,
+		               round_up(min_t(unsigned, PAGE_SIZE, bytes - off),
+		                        SECTOR_SIZE)))
+			return false;
+
+	return gpt_crc32(table->entries, bytes) == entries_crc;
+}
+
+
+/*
+ * Add the partitions of the GUID partition table
+ *
+ * The primary table at LBA 1 is used if valid, the backup table at the
+ * last LBA of the disk otherwise.
+ */
+static void block_scan_gpt(struct gendisk * const disk, u8 * const buf)
+{
+	struct gpt_table table = { };
+	unsigned i;
+
+	table.entries = lx_emul_mem_alloc_aligned(GPT_MAX_ENTRIES * 128, PAGE_SIZE);
+
+	if (!gpt_read(disk, 1, buf, &table)) {
+
+		printk("%s: invalid primary GPT, trying the backup\n", disk->disk_name);
+
+		if (!gpt_read(disk, get_capacity(disk) - 1, buf, &table)) {
+			printk("%s: no valid GPT\n", disk->disk_name);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < table.count; i++) {
+
+		u8  const * const entry = table.entries + i * table.entry_size;
+		u64 const start = get_unaligned_le64(entry + GPT_ENTRY_FIRST);
+		u64 const end   = get_unaligned_le64(entry + GPT_ENTRY_LAST);
+
+		/* entries with a zero type GUID are unused */
+		if (!memchr_inv(entry, 0, 16))
+			continue;
+
+		if (start < table.first || end > table.last || end < start) {
+			printk("%s: ignoring GPT partition %u outside of usable range\n",
+			       disk->disk_name, i + 1);
+			continue;
+		}
+
+		block_add_partition(disk, i + 1, start, end - start + 1);
+	}
+
+out:
+	lx_emul_mem_free(table.entries);
+}
+
+
+static void block_scan_partitions(struct gendisk * const disk)
+{
+	u8 * const buf = lx_emul_mem_alloc_aligned(PAGE_SIZE, PAGE_SIZE);
+	unsigned i;
+
+	if (block_read(disk, 0, buf, SECTOR_SIZE) || !mbr_valid(buf))
+		goto out;
+
+	for (i = 0; i < 4; i++)
+		if (buf[MBR_ENTRIES + 16*i + 4] == MBR_TYPE_GPT) {
+			block_scan_gpt(disk, buf);
+			goto out;
+		}
+
+	block_scan_mbr(disk, buf);
+
+out:
+	lx_emul_mem_free(buf);
+}
+
+
+/*
+ * Context of a bio submitted on behalf of a client request
+ *
+ * The context precedes each bio allocated from 'block_bio_set' as front
+ * padding.
+ */
+struct block_bio
+{
+	struct block_completion done;
+	bool                    polled;
+	u64                     write_seq;  /* 0 for other than writes */
+	struct bio              bio;
+};
+
+
+static struct bio_set block_bio_set;
+
+
+/*
+ * Account the completion of a client write
+ *
+ * Once the last write preceding the pending syncs is completed, the block
+ * task flushes on their behalf.
+ */
+static void block_write_complete(struct block_disk * const bdisk,
+                                 u64                 const write_seq)
+{
+	bdisk->writes_in_flight--;
+	bdisk->dirty = true;
+
+	if (write_seq <= bdisk->barrier && bdisk->barrier_writes)
+		bdisk->barrier_writes--;
+}
+
+
+/*
+ * Complete the client request of the last bio of a chain
+ *
+ * The bio is put once the block task acknowledged the request.
+ */
 static void bio_end_io(struct bio *bio)
 {
-	struct genode_block_request * const req =
-		(struct genode_block_request*) bio->bi_private;
-	struct genode_block_session * const session =
-		genode_block_session_by_name(bio->bi_disk->disk_name);
+	struct block_bio * const ctx = container_of(bio, struct block_bio, bio);
+	struct block_dev * const dev = ctx->done.dev;
+
+	if (ctx->polled && dev->polled_in_flight)
+		dev->polled_in_flight--;
+
+	if (ctx->write_seq)
+		block_write_complete(dev->bdisk, ctx->write_seq);
+
+	ctx->done.bio = bio;
+	block_complete(&ctx->done, bio->bi_status == BLK_STS_OK);
+	block_wakeup();
+}
+
+
+static void block_flush_end_io(struct bio *bio)
+{
+	struct block_disk * const bdisk = bio->bi_private;
+
+	block_complete_syncs(&bdisk->flushing_syncs, bio->bi_status == BLK_STS_OK);
+
+	bdisk->flushing = false;
+
+	/*
+	 * Syncs arrived meanwhile are covered by this flush as well if no
+	 * write completed since its submission and none of their preceding
+	 * writes is still in flight. Otherwise the block task flushes on their
+	 * behalf.
+	 */
+	if (!bdisk->dirty && !bdisk->barrier_writes)
+		block_complete_syncs(&bdisk->pending, bio->bi_status == BLK_STS_OK);
 
-	if (session) {
-		genode_block_ack_request(session, req, true);
-		lx_user_handle_io();
-	} else
-		printk("Error: could not find session or gendisk for bio %p\n", bio);
+	block_wakeup();
 
 	bio_put(bio);
 }
 
 
-static inline int block_sync(struct block_device * const bdev)
+/*
+ * Return true if the pending syncs are due for a flush
+ */
+static bool block_flush_due(struct block_disk const * const bdisk)
 {
-	if (blkdev_issue_flush(bdev, GFP_KERNEL)) {
-		printk("blkdev_issue_flush failed!\n");
-		return 0;
+	return !list_empty(&bdisk->pending) && !bdisk->flushing &&
+	       !bdisk->barrier_writes && !bdisk->removed;
+}
+
+
+/*
+ * Flush the volatile cache of the card on behalf of all pending syncs
+ *
+ * The flush is an empty write bio with 'REQ_PREFLUSH', which covers all
+ * writes completed so far. If the card has no volatile cache, the block
+ * layer completes the bio right away.
+ */
+static void block_flush(struct block_disk * const bdisk)
+{
+	struct bio * const bio = bio_alloc(GFP_KERNEL, 0);
+
+	list_splice_init(&bdisk->pending, &bdisk->flushing_syncs);
+
+	bdisk->flushing = true;
+	bdisk->dirty    = false;
+
+	bio_set_dev(bio, bdisk->disk->part0);
+
+	bio->bi_end_io  = block_flush_end_io;
+	bio->bi_opf     = REQ_OP_WRITE | REQ_PREFLUSH;
+	bio->bi_private = bdisk;
+
+	submit_bio(bio);
+}
+
+
+/*
+ * Handle a client sync request
+ *
+ * Without writes in flight or completed since the last finished flush,
+ * there is nothing to flush. Otherwise the request joins the syncs covered
+ * by the next flush. Back-to-back syncs of the same or of different
+ * partitions therefore result in one flush.
+ */
+static void block_sync_request(struct block_disk           * const bdisk,
+                               struct block_dev            * const dev,
+                               struct genode_block_request * const request,
+                               ktime_t                       const start)
+{
+	struct block_completion * sync;
+
+	if (!bdisk->dirty && !bdisk->flushing && !bdisk->writes_in_flight) {
+		block_ack(dev, request, start, true);
+		return;
 	}
-	return 1;
+
+	sync = kmalloc(sizeof(*sync), GFP_KERNEL);
+	if (!sync) {
+		block_ack(dev, request, start, false);
+		return;
+	}
+
+	sync->dev     = dev;
+	sync->request = request;
+	sync->start   = start;
+	sync->bio     = NULL;
+	list_add_tail(&sync->list, &bdisk->pending);
+
+	/* the flush has to wait for all writes submitted so far */
+	bdisk->barrier        = bdisk->write_seq;
+	bdisk->barrier_writes = bdisk->writes_in_flight;
 }
 
 
-static inline void block_request(struct block_device         * const bdev,
-                                 struct genode_block_request * const request,
-                                 bool                          write)
+static struct bio * block_bio_alloc(struct block_dev            * const dev,
+                                    struct genode_block_request * const request,
+                                    ktime_t                       start,
+                                    unsigned                      op,
+                                    sector_t                      sector,
+                                    unsigned long                 pages)
 {
-	struct bio  * bio  = bio_alloc(GFP_KERNEL, 1);
-	struct page * page = virt_to_page(request->addr);
+	struct bio * bio =
+		bio_alloc_bioset(GFP_KERNEL, min_t(unsigned long, pages, BIO_MAX_PAGES),
+		                 &block_bio_set);
+	struct block_bio * const ctx = container_of(bio, struct block_bio, bio);
+
+	ctx->done.dev     = dev;
+	ctx->done.request = request;
+	ctx->done.start   = start;
+	ctx->done.bio     = NULL;
+	ctx->polled       = false;
+	ctx->write_seq    = 0;
 
-	bio_set_dev(bio, bdev);
+	bio_set_dev(bio, dev->disk->part0);
 
-	bio->bi_iter.bi_sector = request->blk_nr;
+	bio->bi_iter.bi_sector = sector;
 	bio->bi_end_io         = bio_end_io;
-	bio->bi_opf            = write ? REQ_OP_WRITE : REQ_OP_READ;
-	bio->bi_private        = request;
+	bio->bi_opf            = op;
 
 	bio_set_flag(bio, BIO_WORKINGSET);
-	bio_add_page(bio, page, request->blk_cnt * 512,
-	             (unsigned long)request->addr & (PAGE_SIZE-1));
+	return bio;
+}
+
+
+/*
+ * Submit a client request as scatter-gather bio
+ *
+ * The request buffer is part of the DMA buffer shared with the client,
+ * whose page objects are contiguous. Adjacent pages are merged into
+ * multi-page segments by 'bio_add_page', so the block layer splits the
+ * request only at the segment and transfer-size limits of the host
+ * controller. Requests exceeding one bio are covered by a chain of bios,
+ * the last of which completes the client request.
+ */
+static inline void block_request(struct block_dev            * const dev,
+                                 struct genode_block_request * const request,
+                                 ktime_t                       const start,
+                                 bool                          write)
+{
+	unsigned long       addr = (unsigned long)request->addr;
+	unsigned long const end  = addr + request->blk_cnt * 512;
+	unsigned      const op   = write ? REQ_OP_WRITE : REQ_OP_READ;
+
+	struct bio * bio =
+		block_bio_alloc(dev, request, start, op, dev->start + request->blk_nr,
+		                DIV_ROUND_UP(end - (addr & PAGE_MASK), PAGE_SIZE));
+
+	while (addr < end) {
+
+		unsigned const offset = addr & (PAGE_SIZE-1);
+		unsigned const len    = min_t(unsigned long, PAGE_SIZE - offset,
+		                              end - addr);
+
+		if (bio_add_page(bio, virt_to_page((void *)addr), len, offset) == len) {
+			addr += len;
+			continue;
+		}
+
+		/* bio is full, continue with a chained one */
+		{
+			struct bio * const next =
+				block_bio_alloc(dev, request, start, op, bio_end_sector(bio),
+				                DIV_ROUND_UP(end - (addr & PAGE_MASK), PAGE_SIZE));
+
+			bio_chain(bio, next);
+			submit_bio(bio);
+			bio = next;
+		}
+	}
+
+	/* the last bio of the chain completes the request */
+	if (write) {
+		struct block_disk * const bdisk = dev->bdisk;
+
+		bdisk->writes_in_flight++;
+		container_of(bio, struct block_bio, bio)->write_seq = ++bdisk->write_seq;
+	}
+
+	if (dev->poll_max_size &&
+	    ((unsigned long)request->blk_cnt << SECTOR_SHIFT) <= dev->poll_max_size) {
+		container_of(bio, struct block_bio, bio)->polled = true;
+		dev->polled_in_flight++;
+	}
+
 	submit_bio(bio);
 }
 
 
+/*
+ * Submit a client trim request as discard bio
+ *
+ * The block layer splits the bio according to the discard granularity and
+ * size limits of the queue, which the MMC block driver derives from the
+ * erase-group size of the card. It issues MMC DISCARD, TRIM or ERASE
+ * depending on the capabilities of the card.
+ */
+static inline void block_discard(struct block_dev            * const dev,
+                                 struct genode_block_request * const request,
+                                 ktime_t                       const start)
+{
+	/* the size of a bio is limited to 4 GiB */
+	sector_t const max_sectors = round_down(UINT_MAX >> 9, PAGE_SIZE >> 9);
+
+	sector_t sector = dev->start + request->blk_nr;
+	sector_t count  = request->blk_cnt;
+	struct bio * bio = NULL;
+
+	/* trim is a hint, which is fulfilled trivially without card support */
+	if (!blk_queue_discard(dev->disk->queue) || !count) {
+		block_ack(dev, request, start, true);
+		return;
+	}
+
+	while (count) {
+
+		sector_t const sectors = min(count, max_sectors);
+		struct bio * const next =
+			block_bio_alloc(dev, request, start, REQ_OP_DISCARD, sector, 0);
+
+		next->bi_iter.bi_size = sectors << 9;
+
+		if (bio) {
+			bio_chain(bio, next);
+			submit_bio(bio);
+		}
+
+		bio     = next;
+		sector += sectors;
+		count  -= sectors;
+	}
+
+	submit_bio(bio);
+}
+
+
+/*
+ * Return the interrupt of the SD host controller serving 'disk'
+ *
+ * All hosts of the driver are uSDHC controllers driven by 'sdhci'.
+ */
+static int block_host_irq(struct gendisk * const disk)
+{
+	struct mmc_queue * const mq = disk->queue->queuedata;
+
+	if (!mq || !mq->card)
+		return -1;
+
+	return ((struct sdhci_host *)mmc_priv(mq->card->host))->irq;
+}
+
+
+/*
+ * Complete the polled requests of 'dev' without waiting for the interrupt
+ *
+ * The interrupt of the host controller is handled by 'generic_handle_irq'
+ * as on its occurrence, which finishes the MMC request if the controller
+ * signals its completion. Interrupts are handled by the same cooperatively
+ * scheduled context, so polling cannot race with the regular handling of
+ * the interrupt. The block task yields in between, so the MMC queue can
+ * dispatch requests and the completion work can run. Polling ends once all
+ * polled requests are completed or the polling budget is exhausted, leaving
+ * the remaining requests to the interrupt.
+ */
+static void block_poll(struct block_dev * const dev)
+{
+	ktime_t const deadline = ktime_add_us(ktime_get(), block_poll_budget_us);
+	int     const irq      = block_host_irq(dev->disk);
+
+	if (irq < 0)
+		return;
+
+	while (dev->polled_in_flight && !dev->bdisk->removed
+	    && ktime_before(ktime_get(), deadline)) {
+
+		generic_handle_irq(irq);
+		lx_emul_task_schedule(false);
+	}
+}
+
+
+/*
+ * Check that a client request stays within the sectors of the device
+ */
+static bool block_request_valid(struct block_dev            const * const dev,
+                                struct genode_block_request const * const req)
+{
+	return req->blk_cnt <= dev->count &&
+	       req->blk_nr  <= dev->count - req->blk_cnt;
+}
+
+
 static inline void
-block_handle_session(struct genode_block_session * const session,
-                     struct gendisk              * const disk)
+block_handle_session(struct block_dev * const dev)
 {
-	if (!session)
+	struct block_disk * const bdisk = dev->bdisk;
+	struct blk_plug plug;
+	ktime_t start;
+
+	if (!dev->session)
 		return;
 
-	for (;;) {
+	/* latencies include the time spent in the batch */
+	start = ktime_get();
+
+	/*
+	 * Submit all pending requests of the session under one plug, so the
+	 * block layer merges adjacent requests and hands them to the MMC
+	 * queue as one batch. The MMC queue keeps up to 'MMC_QUEUE_DEPTH'
+	 * requests in flight and prepares the DMA mapping of the next request
+	 * while the current one is transferred.
+	 */
+	blk_start_plug(&plug);
+
+	while (!bdisk->removed && dev->session) {
 		struct genode_block_request * const req =
-			genode_block_request_by_session(session);
-		struct block_device * const bdev = disk->part0;
+			genode_block_request_by_session(dev->session);
 
 		if (!req)
-			return;
+			break;
+
+		dev->stats.in_flight++;
+		dev->stats.in_flight_max = max(dev->stats.in_flight_max,
+		                               dev->stats.in_flight);
+
+		/* reject requests beyond the device or modifying a read-only one */
+		if ((req->op != GENODE_BLOCK_SYNC && !block_request_valid(dev, req))
+		 || (req->op != GENODE_BLOCK_READ && req->op != GENODE_BLOCK_SYNC
+		     && !dev->writeable)) {
+			block_ack(dev, req, start, false);
+			continue;
+		}
 
 		switch (req->op) {
 		case GENODE_BLOCK_READ:
-			block_request(bdev, req, false);
+			block_request(dev, req, start, false);
 			break;
 		case GENODE_BLOCK_WRITE:
-			block_request(bdev, req, true);
+			block_request(dev, req, start, true);
 			break;
 		case GENODE_BLOCK_SYNC:
-			genode_block_ack_request(session, req, block_sync(bdev));
-		default: ;
+			block_sync_request(bdisk, dev, req, start);
+			break;
+		case GENODE_BLOCK_TRIM:
+			block_discard(dev, req, start);
+			break;
+		default:
+			block_ack(dev, req, start, false);
 		};
 	}
+
+	blk_finish_plug(&plug);
+
+	/* submit the flush after the writes of the batch left the plug */
+	if (block_flush_due(bdisk))
+		block_flush(bdisk);
+
+	if (dev->polled_in_flight)
+		block_poll(dev);
+
+	/* the session stays valid until the block task blocks */
+	block_ack_completed(dev);
 }
 
 
 static int block_poll_sessions(void * data)
 {
 	for (;;) {
-		unsigned idx;
+		struct block_disk * bdisk;
+		struct block_dev  * dev;
+
+		/*
+		 * Sessions are opened and closed by the entrypoint only while the
+		 * block task is blocked. So the session of a device is looked up
+		 * once per run if a client signalled new requests or completed
+		 * requests are to be acknowledged, and not at all otherwise.
+		 */
+		bool const signalled = block_sessions_signalled;
+
+		block_sessions_signalled = false;
 
-		for (idx = 0; idx < MAX_GEN_DISKS; idx++) {
+		block_reap();
 
-			struct gendisk * const disk = gendisks[idx];
+		/*
+		 * Disks and devices are only freed by 'block_reap', so the lists
+		 * stay intact while the task yields during the partition scan or
+		 * polling.
+		 */
+		list_for_each_entry(bdisk, &block_disks, list) {
 
-			if (!disk)
+			if (bdisk->removed)
 				continue;
 
-			block_handle_session(genode_block_session_by_name(disk->disk_name),
-			                     disk);
+			if (bdisk->unscanned) {
+				bdisk->unscanned = false;
+				block_scan_partitions(bdisk->disk);
+			}
+
+			/* flush on behalf of syncs whose preceding writes completed */
+			if (block_flush_due(bdisk))
+				block_flush(bdisk);
+
+			list_for_each_entry(dev, &bdisk->devs, list) {
+
+				if (bdisk->removed)
+					break;
+
+				if (!signalled && list_empty(&dev->completed))
+					continue;
+
+				dev->session = genode_block_session_by_name(dev->name);
+
+				block_ack_completed(dev);
+				block_handle_session(dev);
+			}
 		}
 
 		lx_emul_task_schedule(true);
@@ -213,18 +1353,107 @@ static int block_poll_sessions(void * data)
 }
 
 
-static struct task_struct * lx_user_task = NULL;
+void lx_user_for_each_block_stats(void (*fn)(struct lx_user_block_stats const *, void *),
+                                  void *data)
+{
+	ktime_t const now = ktime_get();
+	struct block_disk * bdisk;
+	struct block_dev  * dev;
+	unsigned op;
+
+	list_for_each_entry(bdisk, &block_disks, list) {
+
+		if (bdisk->removed)
+			continue;
+
+		list_for_each_entry(dev, &bdisk->devs, list) {
+
+			u64 const us = ktime_us_delta(now, dev->stats_time);
 
+			for (op = 0; op < LX_USER_BLOCK_OPS; op++) {
 
+				struct lx_user_block_op_stats * const stats = &dev->stats.ops[op];
+
+				if (us) {
+					stats->requests_per_sec =
+						div64_u64((stats->requests - dev->stats_requests[op]) * USEC_PER_SEC, us);
+					stats->bytes_per_sec =
+						div64_u64((stats->bytes - dev->stats_bytes[op]) * USEC_PER_SEC, us);
+				}
+
+				dev->stats_requests[op] = stats->requests;
+				dev->stats_bytes[op]    = stats->bytes;
+			}
+
+			dev->stats_time    = now;
+			dev->stats.session = !!genode_block_session_by_name(dev->name);
+
+			fn(&dev->stats, data);
+
+			/* report the maximum depth per interval */
+			dev->stats.in_flight_max = dev->stats.in_flight;
+		}
+	}
+}
+
+
+void lx_user_for_each_block_disk_stats(void (*fn)(struct lx_user_block_disk_stats const *, void *),
+                                       void *data)
+{
+	static int const groups[LX_USER_BLOCK_DISK_GROUPS] = {
+		[LX_USER_BLOCK_DISK_READ]    = STAT_READ,
+		[LX_USER_BLOCK_DISK_WRITE]   = STAT_WRITE,
+		[LX_USER_BLOCK_DISK_DISCARD] = STAT_DISCARD,
+		[LX_USER_BLOCK_DISK_FLUSH]   = STAT_FLUSH,
+	};
+
+	struct block_disk * bdisk;
+	unsigned i;
+
+	list_for_each_entry(bdisk, &block_disks, list) {
+
+		struct gendisk      * const disk = bdisk->disk;
+		struct block_device * const part = disk->part0;
+		struct lx_user_block_disk_stats stats = { };
+
+		if (bdisk->removed)
+			continue;
+
+		stats.name = disk->disk_name;
+
+		for (i = 0; i < LX_USER_BLOCK_DISK_GROUPS; i++) {
+			stats.ios[i]     = part_stat_read(part, ios[groups[i]]);
+			stats.merges[i]  = part_stat_read(part, merges[groups[i]]);
+			stats.sectors[i] = part_stat_read(part, sectors[groups[i]]);
+			stats.time_us[i] = div_u64(part_stat_read(part, nsecs[groups[i]]),
+			                           NSEC_PER_USEC);
+		}
+
+		fn(&stats, data);
+	}
+}
+
+
+/*
+ * Called by the Genode frontend on signals of the block sessions
+ */
 void lx_user_handle_io(void)
 {
-	if (lx_user_task)
-		lx_emul_task_unblock(lx_user_task);
+	block_sessions_signalled = true;
+	block_wakeup();
 }
 
 
 void lx_user_init(void)
 {
-	int pid = kernel_thread(block_poll_sessions, NULL, CLONE_FS | CLONE_FILES);
-	lx_user_task = find_task_by_pid_ns(pid, NULL);;
+	int pid;
+
+	if (bioset_init(&block_bio_set, BIO_POOL_SIZE,
+	                offsetof(struct block_bio, bio), BIOSET_NEED_BVECS)) {
+		printk("Error: could not initialize bio set\n");
+		return;
+	}
+
+	pid = kernel_thread(block_poll_sessions, NULL, CLONE_FS | CLONE_FILES);
+	lx_user_task = find_task_by_pid_ns(pid, NULL);
 }
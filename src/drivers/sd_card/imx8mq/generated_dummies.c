@@ -1123,14 +1123,6 @@ int nonseekable_open(struct inode * inode,struct file * filp)
 }
 
 
-#include <linux/irq.h>
-
-void note_interrupt(struct irq_desc * desc,irqreturn_t action_ret)
-{
-	lx_emul_trace_and_stop(__func__);
-}
-
-
 #include <linux/clk.h>
 
 struct clk * of_clk_get(struct device_node * np,int index)
@@ -1220,14 +1212,6 @@ int pinctrl_pm_select_sleep_state(struct device * dev)
 }
 
 
-#include <linux/pinctrl/consumer.h>
-
-int pinctrl_select_state(struct pinctrl * p,struct pinctrl_state * state)
-{
-	lx_emul_trace_and_stop(__func__);
-}
-
-
 #include <linux/pm.h>
 
 int pm_generic_resume(struct device * dev)
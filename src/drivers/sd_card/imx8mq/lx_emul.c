@@ -86,3 +86,221 @@ nodemask_t node_states[NR_NODE_STATES] __read_mostly = {
 #include <linux/nodemask.h>
 
 unsigned int nr_node_ids = MAX_NUMNODES;
+
+
+#include <linux/io.h>
+#include <linux/of.h>
+#include <linux/pinctrl/consumer.h>
+#include <linux/slab.h>
+#include <../drivers/mmc/host/sdhci.h>
+
+/*
+ * Pin states of the uSDHC
+ *
+ * The uSDHC driver selects the pad states for 100 MHz and 200 MHz bus
+ * clocks when switching to SDR50/DDR50 respectively SDR104/HS200/HS400,
+ * which raise the drive strength and slew rate of the pads. There is no
+ * pin-controller driver, hence the states of the device tree are written
+ * to the IOMUXC directly. Each pin of a 'fsl,pins' group consists of the
+ * cells mux_reg, conf_reg, input_reg, mux_val, input_val, and conf_val,
+ * whereby a register offset of zero denotes an absent register.
+ */
+
+enum {
+	IOMUXC_BASE        = 0x30330000,
+	IOMUXC_SIZE        = 0x1000,
+	IOMUXC_CONFIG_SION = 1 << 4,
+	IMX_PAD_SION       = 0x40000000,
+	IMX_NO_PAD_CTL     = 0x80000000,
+	IMX_PIN_CELLS      = 6,
+};
+
+static void __iomem *iomuxc;
+
+
+struct pinctrl
+{
+	struct device_node *np;
+};
+
+
+struct pinctrl_state
+{
+	struct device_node *np;
+	int                 index;  /* within 'pinctrl-names' */
+};
+
+
+static bool iomuxc_reg_valid(u32 reg) {
+	return reg <= IOMUXC_SIZE - sizeof(u32) && IS_ALIGNED(reg, sizeof(u32)); }
+
+
+/*
+ * Apply all pin groups of a state, or merely validate them if 'apply' is
+ * false
+ */
+static int iomuxc_state(struct device_node *np, int index, bool apply)
+{
+	char prop[16];
+	int  i;
+
+	snprintf(prop, sizeof(prop), "pinctrl-%d", index);
+
+	for (i = 0; ; i++) {
+		struct device_node * const group = of_parse_phandle(np, prop, i);
+		__be32 const *pins;
+		int len, n, err = 0;
+
+		if (!group)
+			return i ? 0 : -ENOENT;
+
+		pins = of_get_property(group, "fsl,pins", &len);
+		if (!pins || !len || len % (IMX_PIN_CELLS * sizeof(u32)))
+			err = -EINVAL;
+
+		for (n = 0; !err && n < len / (int)sizeof(u32); n += IMX_PIN_CELLS) {
+			u32 const mux_reg   = be32_to_cpu(pins[n]);
+			u32 const conf_reg  = be32_to_cpu(pins[n + 1]);
+			u32 const input_reg = be32_to_cpu(pins[n + 2]);
+			u32       mux_val   = be32_to_cpu(pins[n + 3]);
+			u32 const input_val = be32_to_cpu(pins[n + 4]);
+			u32 const conf_val  = be32_to_cpu(pins[n + 5]);
+
+			if (!iomuxc_reg_valid(mux_reg) || !iomuxc_reg_valid(conf_reg) ||
+			    !iomuxc_reg_valid(input_reg)) {
+				err = -EINVAL;
+				break;
+			}
+
+			if (!apply)
+				continue;
+
+			if (conf_val & IMX_PAD_SION)
+				mux_val |= IOMUXC_CONFIG_SION;
+
+			if (mux_reg)
+				writel(mux_val, iomuxc + mux_reg);
+
+			if (conf_reg && !(conf_val & IMX_NO_PAD_CTL))
+				writel(conf_val & ~IMX_PAD_SION, iomuxc + conf_reg);
+
+			if (input_reg)
+				writel(input_val, iomuxc + input_reg);
+		}
+
+		of_node_put(group);
+
+		if (err)
+			return err;
+	}
+}
+
+
+static bool iomuxc_state_valid(struct device_node *np, char const *name)
+{
+	int const index = of_property_match_string(np, "pinctrl-names", name);
+
+	return index >= 0 && !iomuxc_state(np, index, false);
+}
+
+
+/*
+ * Called by the uSDHC driver while probing, after 'sdhci_pltfm_init'
+ * stored the host as driver data, and before the host capabilities are
+ * evaluated by 'sdhci_add_host'
+ */
+struct pinctrl * devm_pinctrl_get(struct device * dev)
+{
+	struct sdhci_host * const host = dev_get_drvdata(dev);
+	struct device_node * const np  = dev->of_node;
+	struct pinctrl *p;
+
+	if (!iomuxc)
+		iomuxc = ioremap(IOMUXC_BASE, IOMUXC_SIZE);
+
+	if (iomuxc && np && iomuxc_state_valid(np, "state_100mhz")
+	              && iomuxc_state_valid(np, "state_200mhz")) {
+
+		p = devm_kzalloc(dev, sizeof(*p), GFP_KERNEL);
+		if (!p)
+			return ERR_PTR(-ENOMEM);
+
+		p->np = np;
+		return p;
+	}
+
+	/*
+	 * Without the high-speed pad settings, the bus modes above 50 MHz are
+	 * not safe to use. Disabling 1.8 V signalling rules out UHS-I, HS200,
+	 * and HS400.
+	 */
+	dev_warn(dev, "no high-speed pin states, UHS-I/HS200/HS400 disabled\n");
+
+	if (host)
+		host->quirks2 |= SDHCI_QUIRK2_NO_1_8_V;
+
+	return ERR_PTR(-ENODEV);
+}
+
+
+struct pinctrl_state * pinctrl_lookup_state(struct pinctrl * p,const char * name)
+{
+	int const index = of_property_match_string(p->np, "pinctrl-names", name);
+	struct pinctrl_state *state;
+
+	if (index < 0)
+		return ERR_PTR(-ENODEV);
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return ERR_PTR(-ENOMEM);
+
+	state->np    = p->np;
+	state->index = index;
+	return state;
+}
+
+
+int pinctrl_select_state(struct pinctrl * p,struct pinctrl_state * state)
+{
+	return iomuxc_state(state->np, state->index, true);
+}
+
+
+#include <linux/mmc/host.h>
+#include <../drivers/mmc/core/card.h>
+
+/*
+ * Called once the card got initialized, used to report the negotiated
+ * bus mode instead of creating debugfs entries
+ */
+void mmc_add_card_debugfs(struct mmc_card * card)
+{
+	static char const * const timings[] = {
+		[MMC_TIMING_LEGACY]     = "legacy",
+		[MMC_TIMING_MMC_HS]     = "MMC high-speed",
+		[MMC_TIMING_SD_HS]      = "SD high-speed",
+		[MMC_TIMING_UHS_SDR12]  = "UHS-I SDR12",
+		[MMC_TIMING_UHS_SDR25]  = "UHS-I SDR25",
+		[MMC_TIMING_UHS_SDR50]  = "UHS-I SDR50",
+		[MMC_TIMING_UHS_SDR104] = "UHS-I SDR104",
+		[MMC_TIMING_UHS_DDR50]  = "UHS-I DDR50",
+		[MMC_TIMING_MMC_DDR52]  = "MMC DDR52",
+		[MMC_TIMING_MMC_HS200]  = "HS200",
+		[MMC_TIMING_MMC_HS400]  = "HS400",
+	};
+
+	struct mmc_ios const * const ios = &card->host->ios;
+
+	char const * const timing = ios->timing < ARRAY_SIZE(timings)
+	                          ? timings[ios->timing] : "unknown";
+
+	char const * const voltage =
+		ios->signal_voltage == MMC_SIGNAL_VOLTAGE_180 ? "1.8" :
+		ios->signal_voltage == MMC_SIGNAL_VOLTAGE_120 ? "1.2" : "3.3";
+
+	printk("%s: bus mode %s%s, %u MHz, %u-bit, %s V signalling\n",
+	       mmc_hostname(card->host), timing,
+	       mmc_card_hs400es(card) ? " enhanced strobe" : "",
+	       ios->clock / 1000000, 1U << ios->bus_width, voltage);
+}
@@ -0,0 +1,123 @@
+/*
+ * \brief  Interface between the Genode frontend and the Linux-side block task
+ * \author Stefan Kalkowski
+ * \date   2022-10-17
+ */
+
+/*
+ * Copyright (C) 2022 Genode Labs GmbH
+ *
+ * This file is distributed under the terms of the GNU General Public License
+ * version 2.
+ */
+
+#ifndef _LX_USER_H_
+#define _LX_USER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum lx_user_block_op {
+	LX_USER_BLOCK_READ,
+	LX_USER_BLOCK_WRITE,
+	LX_USER_BLOCK_SYNC,
+	LX_USER_BLOCK_TRIM,
+	LX_USER_BLOCK_OPS
+};
+
+/*
+ * Bucket 0 counts latencies below 1 us, bucket n latencies below 2^n us,
+ * and the last bucket all latencies of at least 2^(n-1) us
+ */
+enum { LX_USER_BLOCK_LATENCY_BUCKETS = 20 };
+
+struct lx_user_block_op_stats
+{
+	unsigned long long requests;
+	unsigned long long bytes;
+	unsigned long long errors;
+	unsigned long long latency_max_us;
+	unsigned long long latency[LX_USER_BLOCK_LATENCY_BUCKETS];
+
+	/* rates since the previous call of 'lx_user_for_each_block_stats' */
+	unsigned long long requests_per_sec;
+	unsigned long long bytes_per_sec;
+};
+
+/*
+ * Statistics of one block device, i.e., a disk or a partition, and its
+ * session
+ */
+struct lx_user_block_stats
+{
+	char const *name;
+	char const *disk;
+	bool        session;
+	unsigned    in_flight;
+	unsigned    in_flight_max;
+
+	struct lx_user_block_op_stats ops[LX_USER_BLOCK_OPS];
+};
+
+/**
+ * Call 'fn' for each announced block device
+ */
+void lx_user_for_each_block_stats(void (*fn)(struct lx_user_block_stats const *, void *),
+                                  void *data);
+
+
+enum lx_user_block_disk_group {
+	LX_USER_BLOCK_DISK_READ,
+	LX_USER_BLOCK_DISK_WRITE,
+	LX_USER_BLOCK_DISK_DISCARD,
+	LX_USER_BLOCK_DISK_FLUSH,
+	LX_USER_BLOCK_DISK_GROUPS
+};
+
+/*
+ * I/O accounting of the Linux block layer for a whole disk
+ *
+ * The counters refer to the requests issued to the MMC driver after
+ * merging and splitting, not to client requests.
+ */
+struct lx_user_block_disk_stats
+{
+	char const        *name;
+	unsigned long long ios[LX_USER_BLOCK_DISK_GROUPS];
+	unsigned long long merges[LX_USER_BLOCK_DISK_GROUPS];
+	unsigned long long sectors[LX_USER_BLOCK_DISK_GROUPS];
+	unsigned long long time_us[LX_USER_BLOCK_DISK_GROUPS];
+};
+
+/**
+ * Call 'fn' for each registered disk
+ */
+void lx_user_for_each_block_disk_stats(void (*fn)(struct lx_user_block_disk_stats const *, void *),
+                                       void *data);
+
+
+/*
+ * Polled completion of small requests
+ *
+ * Requests of at most 'max_size' bytes to 'device' are completed by polling
+ * the SD host controller from within the block task for at most
+ * 'budget_us' microseconds, instead of waiting for the interrupt.
+ */
+struct lx_user_block_poll_policy
+{
+	char const    *device;
+	unsigned long  max_size;
+};
+
+/**
+ * Replace the polling policies, effective for subsequent requests
+ */
+void lx_user_block_configure_poll(struct lx_user_block_poll_policy const *policies,
+                                  unsigned count, unsigned budget_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LX_USER_H_ */
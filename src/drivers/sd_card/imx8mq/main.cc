@@ -14,6 +14,9 @@
 #include <base/attached_rom_dataspace.h>
 #include <base/component.h>
 #include <base/env.h>
+#include <os/reporter.h>
+#include <timer_session/connection.h>
+#include <util/reconstructible.h>
 
 #include <lx_emul/init.h>
 #include <lx_emul/shared_dma_buffer.h>
@@ -23,6 +26,8 @@
 
 #include <genode_c_api/block.h>
 
+#include <lx_user.h>
+
 using namespace Genode;
 
 
@@ -45,10 +50,171 @@ struct Main : private Entrypoint::Io_progress_handler
 		genode_block_notify_peers();
 	}
 
+	/*
+	 * Statistics report, generated every 'interval_ms' if enabled by
+	 * '<report stats="yes"/>'
+	 *
+	 * The 'report' attribute of the config node enables the report of the
+	 * block devices only, which is generated by the C-API backend.
+	 */
+	Constructible<Timer::Connection>  report_timer { };
+	Constructible<Expanding_reporter> reporter     { };
+
+	Signal_handler<Main> report_handler { env.ep(), *this,
+	                                      &Main::handle_report };
+
+	static void generate_op_stats(Xml_generator                & xml,
+	                              char const                   * type,
+	                              lx_user_block_op_stats const & op)
+	{
+		if (!op.requests)
+			return;
+
+		xml.node(type, [&] () {
+			xml.attribute("requests",         op.requests);
+			xml.attribute("bytes",            op.bytes);
+			xml.attribute("errors",           op.errors);
+			xml.attribute("requests_per_sec", op.requests_per_sec);
+			xml.attribute("bytes_per_sec",    op.bytes_per_sec);
+			xml.attribute("latency_max_us",   op.latency_max_us);
+
+			unsigned const last = LX_USER_BLOCK_LATENCY_BUCKETS - 1;
+
+			for (unsigned i = 0; i <= last; i++) {
+				if (!op.latency[i])
+					continue;
+
+				xml.node("latency", [&] () {
+					if (i < last)
+						xml.attribute("below_us", 1ULL << i);
+					else
+						xml.attribute("from_us", 1ULL << (i - 1));
+					xml.attribute("count", op.latency[i]);
+				});
+			}
+		});
+	}
+
+	static void generate_stats(lx_user_block_stats const *stats, void *data)
+	{
+		Xml_generator &xml = *static_cast<Xml_generator *>(data);
+
+		xml.node("device", [&] () {
+			xml.attribute("name",          stats->name);
+			xml.attribute("disk",          stats->disk);
+			xml.attribute("session",       stats->session);
+			xml.attribute("in_flight",     stats->in_flight);
+			xml.attribute("in_flight_max", stats->in_flight_max);
+
+			generate_op_stats(xml, "read",  stats->ops[LX_USER_BLOCK_READ]);
+			generate_op_stats(xml, "write", stats->ops[LX_USER_BLOCK_WRITE]);
+			generate_op_stats(xml, "sync",  stats->ops[LX_USER_BLOCK_SYNC]);
+			generate_op_stats(xml, "trim",  stats->ops[LX_USER_BLOCK_TRIM]);
+		});
+	}
+
+	static void generate_disk_stats(lx_user_block_disk_stats const *stats,
+	                                void *data)
+	{
+		Xml_generator &xml = *static_cast<Xml_generator *>(data);
+
+		static char const * const groups[LX_USER_BLOCK_DISK_GROUPS] =
+			{ "read", "write", "discard", "flush" };
+
+		xml.node("disk", [&] () {
+			xml.attribute("name", stats->name);
+
+			for (unsigned i = 0; i < LX_USER_BLOCK_DISK_GROUPS; i++)
+				xml.node(groups[i], [&] () {
+					xml.attribute("ios",     stats->ios[i]);
+					xml.attribute("merges",  stats->merges[i]);
+					xml.attribute("sectors", stats->sectors[i]);
+					xml.attribute("time_us", stats->time_us[i]);
+				});
+		});
+	}
+
+	void handle_report()
+	{
+		if (!reporter.constructed())
+			return;
+
+		reporter->generate([&] (Xml_generator &xml) {
+			lx_user_for_each_block_disk_stats(generate_disk_stats, &xml);
+			lx_user_for_each_block_stats(generate_stats, &xml);
+		});
+	}
+
+	void configure_report(Xml_node const &config)
+	{
+		bool const stats = config.has_sub_node("report") &&
+		                   config.sub_node("report").attribute_value("stats", false);
+
+		if (!stats) {
+			reporter.destruct();
+			report_timer.destruct();
+			return;
+		}
+
+		unsigned const interval_ms =
+			max(100U, config.sub_node("report").attribute_value("interval_ms", 5000U));
+
+		if (!reporter.constructed())
+			reporter.construct(env, "block_stats", "block_stats");
+
+		if (!report_timer.constructed()) {
+			report_timer.construct(env);
+			report_timer->sigh(report_handler);
+		}
+
+		report_timer->trigger_periodic(1000*interval_ms);
+	}
+
+	/*
+	 * Polled completion, enabled per policy by 'poll_max_size'
+	 */
+	void configure_poll(Xml_node const &config)
+	{
+		enum { MAX_POLICIES = 16 };
+
+		using Device = String<64>;
+
+		Device                    devices[MAX_POLICIES];
+		lx_user_block_poll_policy policies[MAX_POLICIES];
+		unsigned                  count = 0;
+
+		auto add_policy = [&] (Xml_node const &policy) {
+
+			size_t const max_size =
+				policy.attribute_value("poll_max_size", Number_of_bytes(0));
+
+			if (!max_size || !policy.has_attribute("device"))
+				return;
+
+			if (count == MAX_POLICIES) {
+				warning("polled completion limited to ", (unsigned)MAX_POLICIES,
+				        " policies");
+				return;
+			}
+
+			devices[count]  = policy.attribute_value("device", Device());
+			policies[count] = { devices[count].string(), max_size };
+			count++;
+		};
+
+		config.for_each_sub_node("policy",         add_policy);
+		config.for_each_sub_node("default-policy", add_policy);
+
+		lx_user_block_configure_poll(policies, count,
+		                             config.attribute_value("poll_budget_us", 1000U));
+	}
+
 	void handle_config()
 	{
 		config.update();
 		genode_block_apply_config(config.xml());
+		configure_report(config.xml());
+		configure_poll(config.xml());
 	}
 
 	void handle_signal()
@@ -33,30 +33,97 @@ void __udelay(unsigned long usecs)
 
 #include <linux/dma-mapping.h>
 
-dma_addr_t dma_map_page_attrs(struct device * dev,
-                              struct page * page,
-                              size_t offset,
-                              size_t size,
-                              enum dma_data_direction dir,
-                              unsigned long attrs)
+#include <linux/dmapool.h>
+
+/*
+ * DMA pool carving fixed-size blocks out of uncached pages
+ *
+ * As in the original implementation, a free block stores the offset of the
+ * next free block of its page, and blocks never cross 'boundary'. Pages are
+ * kept until the pool gets destroyed.
+ */
+struct dma_pool_page
 {
-	dma_addr_t    const dma_addr  = page_to_phys(page);
-	unsigned long const virt_addr = (unsigned long)page_to_virt(page);
+	struct list_head list;
+	void           * vaddr;
+	dma_addr_t       dma;
+	unsigned         in_use;
+	unsigned         offset;  /* first free block, 'allocation' if full */
+};
 
-	lx_emul_mem_cache_clean_invalidate((void *)(virt_addr + offset), size);
-	return dma_addr + offset;
-}
+
+struct dma_pool
+{
+	struct list_head pages;
+	size_t           size;
+	size_t           allocation;
+	size_t           boundary;
+};
 
 
-#include <linux/dmapool.h>
+static struct dma_pool_page * dma_pool_alloc_page(struct dma_pool * pool)
+{
+	unsigned offset = 0;
+	unsigned next_boundary = pool->boundary;
+
+	struct dma_pool_page * page = kmalloc(sizeof(*page), GFP_KERNEL);
+
+	if (!page)
+		return NULL;
+
+	page->vaddr = lx_emul_mem_alloc_aligned_uncached(pool->allocation, PAGE_SIZE);
+	if (!page->vaddr) {
+		kfree(page);
+		return NULL;
+	}
+
+	page->dma    = lx_emul_mem_dma_addr(page->vaddr);
+	page->in_use = 0;
+	page->offset = 0;
+
+	/* link all blocks into the free list of the page */
+	do {
+		unsigned next = offset + pool->size;
+
+		if (next + pool->size > next_boundary) {
+			next = next_boundary;
+			next_boundary += pool->boundary;
+		}
+
+		*(unsigned *)(page->vaddr + offset) = next;
+		offset = next;
+	} while (offset < pool->allocation);
+
+	list_add(&page->list, &pool->pages);
+	return page;
+}
 
-struct dma_pool { size_t size; };
 
 void * dma_pool_alloc(struct dma_pool * pool, gfp_t mem_flags, dma_addr_t * handle)
 {
-	void * ret =
-		lx_emul_mem_alloc_aligned_uncached(pool->size, PAGE_SIZE);
-	*handle = lx_emul_mem_dma_addr(ret);
+	struct dma_pool_page * page;
+	unsigned offset;
+	void * ret;
+
+	list_for_each_entry(page, &pool->pages, list)
+		if (page->offset < pool->allocation)
+			goto ready;
+
+	page = dma_pool_alloc_page(pool);
+	if (!page)
+		return NULL;
+
+ready:
+	offset       = page->offset;
+	page->offset = *(unsigned *)(page->vaddr + offset);
+	page->in_use++;
+
+	ret     = page->vaddr + offset;
+	*handle = page->dma + offset;
+
+	if (mem_flags & __GFP_ZERO)
+		memset(ret, 0, pool->size);
+
 	return ret;
 }
 
@@ -67,42 +134,86 @@ struct dma_pool * dma_pool_create(const char * name,
                                   size_t align,
                                   size_t boundary)
 {
-	struct dma_pool * pool = kmalloc(sizeof(struct dma_pool), GFP_KERNEL);
-	pool->size = size;
+	struct dma_pool * pool;
+
+	if (align == 0)
+		align = 1;
+	else if (align & (align - 1))
+		return NULL;
+
+	if (size == 0)
+		return NULL;
+	else if (size < sizeof(unsigned))
+		size = sizeof(unsigned);
+
+	size = ALIGN(size, align);
+
+	if (!boundary)
+		boundary = max_t(size_t, size, PAGE_SIZE);
+	else if ((boundary < size) || (boundary & (boundary - 1)))
+		return NULL;
+
+	pool = kmalloc(sizeof(struct dma_pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	INIT_LIST_HEAD(&pool->pages);
+	pool->size       = size;
+	pool->allocation = max_t(size_t, size, PAGE_SIZE);
+	pool->boundary   = min_t(size_t, boundary, pool->allocation);
 	return pool;
 }
 
 
 void dma_pool_free(struct dma_pool * pool,void * vaddr,dma_addr_t dma)
 {
-	lx_emul_mem_free(vaddr);
-}
+	struct dma_pool_page * page;
 
+	list_for_each_entry(page, &pool->pages, list) {
 
-#include <linux/dma-mapping.h>
+		unsigned offset;
 
-int dma_supported(struct device * dev,u64 mask)
-{
-	lx_emul_trace(__func__);
-	return 1;
-}
+		if (dma < page->dma || dma >= page->dma + pool->allocation)
+			continue;
 
+		offset = vaddr - page->vaddr;
 
-#include <linux/dma-mapping.h>
+		*(unsigned *)vaddr = page->offset;
+		page->offset = offset;
+		page->in_use--;
+		return;
+	}
 
-void dma_unmap_page_attrs(struct device * dev,
-                          dma_addr_t addr,
-                          size_t size,
-                          enum dma_data_direction dir,
-                          unsigned long attrs)
+	printk("Error: dma_pool_free of unknown block %p\n", vaddr);
+}
+
+
+void dma_pool_destroy(struct dma_pool * pool)
 {
-	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
+	struct dma_pool_page * page, * next;
 
-	if (!virt_addr)
+	if (!pool)
 		return;
 
-	if (dir == DMA_FROM_DEVICE)
-		lx_emul_mem_cache_invalidate((void *)virt_addr, size);
+	list_for_each_entry_safe(page, next, &pool->pages, list) {
+
+		if (page->in_use)
+			printk("Error: dma_pool_destroy of pool with %u busy blocks\n",
+			       page->in_use);
+
+		list_del(&page->list);
+		lx_emul_mem_free(page->vaddr);
+		kfree(page);
+	}
+
+	kfree(pool);
 }
 
 
+#include <linux/dma-mapping.h>
+
+int dma_supported(struct device * dev,u64 mask)
+{
+	lx_emul_trace(__func__);
+	return 1;
+}
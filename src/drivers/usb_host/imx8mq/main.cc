@@ -14,6 +14,8 @@
 #include <base/attached_rom_dataspace.h>
 #include <base/component.h>
 #include <base/env.h>
+#include <timer_session/connection.h>
+#include <util/reconstructible.h>
 
 #include <lx_emul/init.h>
 #include <lx_emul/usb.h>
@@ -28,28 +30,98 @@ using namespace Genode;
 
 struct Main : private Entrypoint::Io_progress_handler
 {
-	Env                  & env;
-	Attached_rom_dataspace dtb_rom        { env, "dtb"           };
-	Signal_handler<Main>   signal_handler { env.ep(), *this,
-	                                        &Main::handle_signal };
-	Sliced_heap            sliced_heap    { env.ram(), env.rm()  };
+	Env                    & env;
+	Attached_rom_dataspace   dtb_rom        { env, "dtb"           };
+	Attached_rom_dataspace   config         { env, "config"        };
+	Signal_handler<Main>     config_handler { env.ep(), *this,
+	                                          &Main::handle_config };
+	Io_signal_handler<Main>  signal_handler { env.ep(), *this,
+	                                          &Main::handle_signal };
+	Sliced_heap              sliced_heap    { env.ram(), env.rm()  };
+
+	/*
+	 * Coalescing of completions
+	 *
+	 * With 'completion_delay_us' configured, peers are notified at most
+	 * once per delay, so the completions of all URBs finished meanwhile
+	 * reach a client with one signal.
+	 */
+	unsigned                         completion_delay_us { 0 };
+	bool                             notify_pending      { false };
+	Constructible<Timer::Connection> notify_timer        { };
+	Signal_handler<Main>             notify_handler      { env.ep(), *this,
+	                                                       &Main::handle_notify };
+
+	void handle_notify()
+	{
+		notify_pending = false;
+		genode_usb_notify_peers();
+	}
 
 	/**
 	 * Entrypoint::Io_progress_handler
 	 */
 	void handle_io_progress() override
 	{
-		genode_usb_notify_peers();
+		if (!notify_timer.constructed()) {
+			genode_usb_notify_peers();
+			return;
+		}
+
+		if (notify_pending)
+			return;
+
+		notify_pending = true;
+		notify_timer->trigger_once(completion_delay_us);
 	}
 
+	unsigned signal_handler_nesting_level = 0;
+
 	void handle_signal()
 	{
+		signal_handler_nesting_level++;
+
 		lx_user_handle_io();
 		Lx_kit::env().scheduler.schedule();
+
+		/*
+		 * Process all URBs submitted by clients meanwhile before leaving
+		 * the signal handler, so the Linux side handles them in one go and
+		 * 'handle_io_progress' is called once for the whole batch.
+		 */
+		if (signal_handler_nesting_level == 1)
+			while (env.ep().dispatch_pending_io_signal());
+
+		signal_handler_nesting_level--;
+	}
+
+	void handle_config()
+	{
+		config.update();
+
+		completion_delay_us =
+			config.xml().attribute_value("completion_delay_us", 0U);
+
+		if (!completion_delay_us) {
+			notify_timer.destruct();
+
+			/* deliver completions held back so far */
+			if (notify_pending)
+				handle_notify();
+			return;
+		}
+
+		if (!notify_timer.constructed()) {
+			notify_timer.construct(env);
+			notify_timer->sigh(notify_handler);
+		}
 	}
 
 	Main(Env & env) : env(env)
 	{
+		config.sigh(config_handler);
+		handle_config();
+
 		Lx_kit::initialize(env);
 		env.exec_static_constructors();
 
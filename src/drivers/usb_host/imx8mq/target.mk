@@ -5,6 +5,7 @@ INC_DIR  = $(PRG_DIR)
 SRC_CC  += main.cc
 SRC_CC  += time.cc
 SRC_CC  += lx_emul/shared_dma_buffer.cc
+SRC_C   += dma_cache.c
 SRC_C   += dummies.c
 SRC_C   += lx_emul.c
 SRC_C   += lx_emul/usb.c
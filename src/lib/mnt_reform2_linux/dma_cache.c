@@ -0,0 +1,101 @@
+/*
+ * \brief  Streaming DMA mappings with direction-aware cache maintenance
+ * \author Stefan Kalkowski
+ * \date   2022-10-17
+ */
+
+/*
+ * Copyright (C) 2022 Genode Labs GmbH
+ *
+ * This file is distributed under the terms of the GNU General Public License
+ * version 2.
+ */
+
+#include <lx_emul.h>
+#include <linux/cache.h>
+#include <linux/dma-mapping.h>
+
+#include "dma_cache.h"
+
+
+static_assert(DMA_CACHE_LINE_SIZE == L1_CACHE_BYTES);
+
+
+/*
+ * Write back dirty lines before the device reads the buffer
+ *
+ * lx_emul offers clean+invalidate only, which needlessly discards lines the
+ * CPU is about to touch again, e.g., the headers of queued packets. On
+ * arm_v8, the clean to the point of coherency is done here directly. On
+ * arm_v7, the outer cache is maintained by the kernel only, hence the clean
+ * falls back to clean+invalidate.
+ */
+void dma_cache_clean_range(const void * addr, unsigned long size)
+{
+#ifdef CONFIG_ARM64
+	unsigned long       line = (unsigned long)addr;
+	unsigned long const end  = line + size;
+
+	for (; line < end; line += DMA_CACHE_LINE_SIZE)
+		asm volatile ("dc cvac, %0" :: "r" (line) : "memory");
+
+	asm volatile ("dsb sy" ::: "memory");
+#else
+	lx_emul_mem_cache_clean_invalidate(addr, size);
+#endif
+}
+
+
+dma_addr_t dma_map_page_attrs(struct device * dev,
+                              struct page * page,
+                              size_t offset,
+                              size_t size,
+                              enum dma_data_direction dir,
+                              unsigned long attrs)
+{
+	dma_addr_t    const dma_addr  = page_to_phys(page);
+	unsigned long const virt_addr = (unsigned long)page_to_virt(page);
+
+	if (!(attrs & DMA_ATTR_SKIP_CPU_SYNC))
+		dma_cache_for_device(virt_addr + offset, size, dir);
+
+	return dma_addr + offset;
+}
+
+
+void dma_unmap_page_attrs(struct device * dev,
+                          dma_addr_t addr,
+                          size_t size,
+                          enum dma_data_direction dir,
+                          unsigned long attrs)
+{
+	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
+
+	if (!virt_addr || (attrs & DMA_ATTR_SKIP_CPU_SYNC))
+		return;
+
+	dma_cache_for_cpu(virt_addr, size, dir);
+}
+
+
+void dma_sync_single_for_cpu(struct device *dev, dma_addr_t addr,
+                             size_t size, enum dma_data_direction dir)
+{
+	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
+
+	if (!virt_addr)
+		return;
+
+	dma_cache_for_cpu(virt_addr, size, dir);
+}
+
+
+void dma_sync_single_for_device(struct device * dev,dma_addr_t addr,size_t size,enum dma_data_direction dir)
+{
+	unsigned long const virt_addr = lx_emul_mem_virt_addr((void*)addr);
+
+	if (!virt_addr)
+		return;
+
+	dma_cache_for_device(virt_addr, size, dir);
+}
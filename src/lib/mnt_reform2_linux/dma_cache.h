@@ -0,0 +1,153 @@
+/*
+ * \brief  Cache maintenance for streaming DMA
+ * \author Stefan Kalkowski
+ * \date   2022-10-17
+ *
+ * The header is free of further Linux includes so that the maintenance can
+ * be tested outside of a driver. It must be included after the definition
+ * of 'enum dma_data_direction'.
+ */
+
+/*
+ * Copyright (C) 2022 Genode Labs GmbH
+ *
+ * This file is distributed under the terms of the GNU General Public License
+ * version 2.
+ */
+
+#ifndef _LIB__MNT_REFORM2_LINUX__DMA_CACHE_H_
+#define _LIB__MNT_REFORM2_LINUX__DMA_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Primitives provided by lx_emul and by 'dma_cache.c'
+ */
+void lx_emul_mem_cache_clean_invalidate(const void * addr, unsigned long size);
+void lx_emul_mem_cache_invalidate(const void * addr, unsigned long size);
+void dma_cache_clean_range(const void * addr, unsigned long size);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+enum { DMA_CACHE_LINE_SIZE = 64 };
+
+enum dma_cache_op {
+	DMA_CACHE_NONE,
+	DMA_CACHE_CLEAN,             /* write back dirty lines */
+	DMA_CACHE_INVALIDATE,        /* discard stale lines */
+	DMA_CACHE_CLEAN_INVALIDATE,  /* write back and discard */
+};
+
+
+/**
+ * Operation before the device accesses the buffer, i.e., on map and on
+ * sync for the device
+ */
+static inline enum dma_cache_op dma_cache_op_for_device(enum dma_data_direction dir)
+{
+	switch (dir) {
+	case DMA_TO_DEVICE:     return DMA_CACHE_CLEAN;
+	case DMA_FROM_DEVICE:   return DMA_CACHE_INVALIDATE;
+	case DMA_BIDIRECTIONAL: return DMA_CACHE_CLEAN_INVALIDATE;
+	default:                return DMA_CACHE_NONE;
+	}
+}
+
+
+/**
+ * Operation before the CPU accesses the buffer, i.e., on unmap and on
+ * sync for the CPU
+ */
+static inline enum dma_cache_op dma_cache_op_for_cpu(enum dma_data_direction dir)
+{
+	switch (dir) {
+	case DMA_FROM_DEVICE:   return DMA_CACHE_INVALIDATE;
+	case DMA_BIDIRECTIONAL: return DMA_CACHE_INVALIDATE;
+	default:                return DMA_CACHE_NONE;
+	}
+}
+
+
+static inline unsigned long dma_cache_line_down(unsigned long addr)
+{
+	return addr & ~(unsigned long)(DMA_CACHE_LINE_SIZE - 1);
+}
+
+
+static inline unsigned long dma_cache_line_up(unsigned long addr)
+{
+	return dma_cache_line_down(addr + DMA_CACHE_LINE_SIZE - 1);
+}
+
+
+/*
+ * Drop stale lines before the CPU reads what the device wrote
+ *
+ * Lines only partially covered by the buffer may hold live data of a
+ * neighbouring object, so these are written back instead of discarded.
+ */
+static inline void dma_cache_invalidate(unsigned long addr, unsigned long size)
+{
+	unsigned long start = addr;
+	unsigned long end   = addr + size;
+
+	if (start != dma_cache_line_down(start)) {
+		start = dma_cache_line_down(start);
+		lx_emul_mem_cache_clean_invalidate((void *)start, DMA_CACHE_LINE_SIZE);
+		start += DMA_CACHE_LINE_SIZE;
+	}
+
+	if (end != dma_cache_line_down(end) && end > start) {
+		end = dma_cache_line_down(end);
+		lx_emul_mem_cache_clean_invalidate((void *)end, DMA_CACHE_LINE_SIZE);
+	}
+
+	if (end > start)
+		lx_emul_mem_cache_invalidate((void *)start, end - start);
+}
+
+
+static inline void dma_cache_apply(unsigned long addr, unsigned long size,
+                                   enum dma_cache_op op)
+{
+	unsigned long const start = dma_cache_line_down(addr);
+	unsigned long const end   = dma_cache_line_up(addr + size);
+
+	if (!size)
+		return;
+
+	switch (op) {
+	case DMA_CACHE_CLEAN:
+		dma_cache_clean_range((void *)start, end - start);
+		break;
+	case DMA_CACHE_CLEAN_INVALIDATE:
+		lx_emul_mem_cache_clean_invalidate((void *)start, end - start);
+		break;
+	case DMA_CACHE_INVALIDATE:
+		dma_cache_invalidate(addr, size);
+		break;
+	case DMA_CACHE_NONE:
+		break;
+	}
+}
+
+
+static inline void dma_cache_for_device(unsigned long addr, unsigned long size,
+                                        enum dma_data_direction dir)
+{
+	dma_cache_apply(addr, size, dma_cache_op_for_device(dir));
+}
+
+
+static inline void dma_cache_for_cpu(unsigned long addr, unsigned long size,
+                                     enum dma_data_direction dir)
+{
+	dma_cache_apply(addr, size, dma_cache_op_for_cpu(dir));
+}
+
+#endif /* _LIB__MNT_REFORM2_LINUX__DMA_CACHE_H_ */
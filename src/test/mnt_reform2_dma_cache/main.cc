@@ -0,0 +1,171 @@
+/*
+ * \brief  Test of the cache maintenance for streaming DMA
+ * \author Stefan Kalkowski
+ * \date   2022-10-17
+ *
+ * The test drives the maintenance of 'dma_cache.c' with the direction of
+ * the Linux kernel on a real buffer. The cache primitives are replaced by
+ * recorders so that the effective operations and ranges can be checked.
+ */
+
+/*
+ * Copyright (C) 2022 Genode Labs GmbH
+ *
+ * This file is distributed under the terms of the GNU General Public License
+ * version 2.
+ */
+
+#include <base/component.h>
+#include <base/log.h>
+
+#include <linux/dma-direction.h>
+#include <dma_cache.h>
+
+using namespace Genode;
+
+
+enum Kind { CLEAN, INVALIDATE, CLEAN_INVALIDATE };
+
+struct Op
+{
+	Kind          kind;
+	unsigned long offset;
+	unsigned long size;
+};
+
+enum { LINE = DMA_CACHE_LINE_SIZE, MAX_OPS = 4 };
+
+static char buffer[4*LINE] __attribute__((aligned(LINE)));
+
+static Op       ops[MAX_OPS];
+static unsigned op_count;
+static bool     out_of_bounds;
+
+
+static void record(Kind kind, const void *addr, unsigned long size)
+{
+	unsigned long const offset = (unsigned long)addr - (unsigned long)buffer;
+
+	if ((unsigned long)addr < (unsigned long)buffer || offset + size > sizeof(buffer)
+	 || op_count == MAX_OPS) {
+		out_of_bounds = true;
+		return;
+	}
+
+	ops[op_count++] = Op { kind, offset, size };
+}
+
+
+extern "C" void lx_emul_mem_cache_clean_invalidate(const void *addr, unsigned long size) {
+	record(CLEAN_INVALIDATE, addr, size); }
+
+
+extern "C" void lx_emul_mem_cache_invalidate(const void *addr, unsigned long size) {
+	record(INVALIDATE, addr, size); }
+
+
+extern "C" void dma_cache_clean_range(const void *addr, unsigned long size) {
+	record(CLEAN, addr, size); }
+
+
+static char const *name(dma_data_direction dir)
+{
+	switch (dir) {
+	case DMA_BIDIRECTIONAL: return "DMA_BIDIRECTIONAL";
+	case DMA_TO_DEVICE:     return "DMA_TO_DEVICE";
+	case DMA_FROM_DEVICE:   return "DMA_FROM_DEVICE";
+	case DMA_NONE:          return "DMA_NONE";
+	}
+	return "<invalid>";
+}
+
+
+static char const *name(Kind kind)
+{
+	switch (kind) {
+	case CLEAN:            return "clean";
+	case INVALIDATE:       return "invalidate";
+	case CLEAN_INVALIDATE: return "clean+invalidate";
+	}
+	return "<invalid>";
+}
+
+
+void Component::construct(Env &env)
+{
+	enum When { FOR_DEVICE, FOR_CPU };
+
+	struct Test
+	{
+		When               when;
+		dma_data_direction dir;
+		unsigned long      offset;
+		unsigned long      size;
+		unsigned           count;
+		Op                 expected[MAX_OPS];
+	};
+
+	static Test const tests[] = {
+
+		/* map or sync for the device */
+		{ FOR_DEVICE, DMA_TO_DEVICE,      10, 150, 1, { { CLEAN, 0, 3*LINE } } },
+		{ FOR_DEVICE, DMA_TO_DEVICE,    LINE, 2*LINE, 1, { { CLEAN, LINE, 2*LINE } } },
+		{ FOR_DEVICE, DMA_FROM_DEVICE,    10, 150, 3, { { CLEAN_INVALIDATE, 0,      LINE },
+		                                                { CLEAN_INVALIDATE, 2*LINE, LINE },
+		                                                { INVALIDATE,       LINE,   LINE } } },
+		{ FOR_DEVICE, DMA_FROM_DEVICE,  LINE, 2*LINE, 1, { { INVALIDATE, LINE, 2*LINE } } },
+		{ FOR_DEVICE, DMA_BIDIRECTIONAL,  10, 150, 1, { { CLEAN_INVALIDATE, 0, 3*LINE } } },
+		{ FOR_DEVICE, DMA_NONE,           10, 150, 0, { } },
+		{ FOR_DEVICE, DMA_TO_DEVICE,      10,   0, 0, { } },
+
+		/* unmap or sync for the CPU */
+		{ FOR_CPU,    DMA_TO_DEVICE,      10, 150, 0, { } },
+		{ FOR_CPU,    DMA_FROM_DEVICE,    10, 150, 3, { { CLEAN_INVALIDATE, 0,      LINE },
+		                                                { CLEAN_INVALIDATE, 2*LINE, LINE },
+		                                                { INVALIDATE,       LINE,   LINE } } },
+		{ FOR_CPU,    DMA_FROM_DEVICE,    10,  20, 1, { { CLEAN_INVALIDATE, 0, LINE } } },
+		{ FOR_CPU,    DMA_BIDIRECTIONAL, LINE, 2*LINE, 1, { { INVALIDATE, LINE, 2*LINE } } },
+		{ FOR_CPU,    DMA_NONE,           10, 150, 0, { } },
+	};
+
+	unsigned failed = 0;
+
+	for (Test const &t : tests) {
+
+		char const * const when = t.when == FOR_DEVICE ? "for device" : "for CPU";
+
+		op_count      = 0;
+		out_of_bounds = false;
+
+		unsigned long const addr = (unsigned long)buffer + t.offset;
+
+		if (t.when == FOR_DEVICE)
+			dma_cache_for_device(addr, t.size, t.dir);
+		else
+			dma_cache_for_cpu(addr, t.size, t.dir);
+
+		bool ok = !out_of_bounds && op_count == t.count;
+		for (unsigned i = 0; ok && i < op_count; i++)
+			ok = ops[i].kind   == t.expected[i].kind
+			  && ops[i].offset == t.expected[i].offset
+			  && ops[i].size   == t.expected[i].size;
+
+		if (ok)
+			continue;
+
+		error(name(t.dir), " ", when, " at ", t.offset, "+", t.size, ":",
+		      out_of_bounds ? " maintenance outside of the buffer" : "");
+		for (unsigned i = 0; i < op_count; i++)
+			error("  ", name(ops[i].kind), " ", ops[i].offset, "+", ops[i].size);
+		failed++;
+	}
+
+	if (failed) {
+		error(failed, " checks failed");
+		env.parent().exit(-1);
+		return;
+	}
+
+	log("--- DMA cache test finished ---");
+	env.parent().exit(0);
+}
@@ -0,0 +1,5 @@
+TARGET   = test-mnt_reform2_dma_cache
+SRC_CC   = main.cc
+LIBS     = base
+INC_DIR += $(REP_DIR)/src/lib/mnt_reform2_linux
+INC_DIR += $(call select_from_ports,mnt_reform2_linux)/linux/include